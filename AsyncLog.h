@@ -0,0 +1,382 @@
+/**
+ * AsyncLog.h - Logging from control loops without waiting for the terminal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef ASYNCLOG_H_
+#define ASYNCLOG_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "core/base/Service.h"
+#include "core/base/Thread.h"
+
+#include "LatencyHistogram.h"
+
+namespace msv {
+
+    using namespace std;
+
+    enum LogLevel {
+        LOG_DEBUG = 0,
+        LOG_INFO = 1,
+        LOG_WARNING = 2,
+        LOG_ERROR = 3,
+        NUMBER_OF_LOG_LEVELS
+    };
+
+    const char* const LOG_LEVEL_NAMES[NUMBER_OF_LOG_LEVELS] = { "debug", "info", "warning", "error" };
+
+    // Sets level to the one called name; returns false and leaves level alone for unknown names.
+    inline bool parseLogLevel(const string &name, LogLevel &level) {
+        for (int32_t i = 0; i < NUMBER_OF_LOG_LEVELS; i++) {
+            if (name == LOG_LEVEL_NAMES[i]) {
+                level = static_cast<LogLevel>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * One log message as the logging thread leaves it: a string literal,
+     * in which every % stands for the next value, and a short copied text
+     * appended to it. Formatting is left to the writer thread.
+     */
+    struct LogRecord {
+        enum {
+            MAX_VALUES = 8,
+            MAX_TEXT = 64
+        };
+
+        int64_t time;           // monotonicMicroseconds() when logged.
+        const char *format;     // Must outlive the writer; string literals do.
+        LogLevel level;
+        uint32_t numberOfValues;
+        double values[MAX_VALUES];
+        char text[MAX_TEXT];    // Zero terminated, truncated to fit.
+    };
+
+    /**
+     * Records of one logging thread on their way to the writer thread.
+     * Lock-free with exactly one producer and one consumer.
+     */
+    class LogRing {
+        public:
+            enum {
+                CAPACITY = 256 // Holds CAPACITY - 1 records.
+            };
+
+            LogRing() :
+                m_head(0),
+                m_tail(0),
+                m_dropped(0) {}
+
+            // Called by the owning thread only; counts the record as dropped if the ring is full.
+            bool push(const LogRecord &record) {
+                const uint32_t tail = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+                const uint32_t next = (tail + 1) % CAPACITY;
+                if (next == __atomic_load_n(&m_head, __ATOMIC_ACQUIRE)) {
+                    __atomic_fetch_add(&m_dropped, 1, __ATOMIC_RELAXED);
+                    return false;
+                }
+                m_records[tail] = record;
+                __atomic_store_n(&m_tail, next, __ATOMIC_RELEASE);
+                return true;
+            }
+
+            // Called by the writer only.
+            bool pop(LogRecord &record) {
+                const uint32_t head = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+                if (head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE)) {
+                    return false;
+                }
+                record = m_records[head];
+                __atomic_store_n(&m_head, (head + 1) % CAPACITY, __ATOMIC_RELEASE);
+                return true;
+            }
+
+            uint64_t getDropped() const {
+                return __atomic_load_n(&m_dropped, __ATOMIC_RELAXED);
+            }
+
+        private:
+            LogRecord m_records[CAPACITY];
+            uint32_t m_head;
+            uint32_t m_tail;
+            uint64_t m_dropped;
+    };
+
+    class AsyncLog;
+
+    // The ring of the calling thread; every thread claims one the first time it logs.
+    static __thread LogRing *threadLogRing = NULL;
+    static __thread const AsyncLog *threadLogRingOwner = NULL;
+
+    /**
+     * Log front end for hot threads: log() filters by level, fills a
+     * fixed-size record and pushes it into the calling thread's ring. It
+     * never allocates, locks or waits; a full ring drops the record and
+     * counts it. An AsyncLogWriter formats and writes the records.
+     */
+    class AsyncLog {
+        private:
+            /**
+             * "Forbidden" copy constructor. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the copy constructor.
+             */
+            AsyncLog(const AsyncLog &);
+
+            /**
+             * "Forbidden" assignment operator. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the assignment operator.
+             */
+            AsyncLog& operator=(const AsyncLog &);
+
+        public:
+            enum {
+                MAX_THREADS = 8
+            };
+
+            AsyncLog() :
+                m_level(LOG_INFO),
+                m_numberOfRings(0),
+                m_unassigned(0),
+                m_output(&cerr) {}
+
+            void setLevel(LogLevel level) {
+                __atomic_store_n(&m_level, static_cast<int32_t>(level), __ATOMIC_RELAXED);
+            }
+
+            bool isEnabled(LogLevel level) const {
+                return static_cast<int32_t>(level) >= __atomic_load_n(&m_level, __ATOMIC_RELAXED);
+            }
+
+            // Where the writer puts the text; set it before starting the writer.
+            void setOutput(ostream &output) {
+                m_output = &output;
+            }
+
+            ostream& getOutput() {
+                return *m_output;
+            }
+
+            void log(LogLevel level, const char *format) {
+                push(level, format, NULL, 0, NULL);
+            }
+
+            void log(LogLevel level, const char *format, double v0) {
+                const double values[] = { v0 };
+                push(level, format, values, 1, NULL);
+            }
+
+            void log(LogLevel level, const char *format, double v0, double v1) {
+                const double values[] = { v0, v1 };
+                push(level, format, values, 2, NULL);
+            }
+
+            void log(LogLevel level, const char *format, double v0, double v1, double v2) {
+                const double values[] = { v0, v1, v2 };
+                push(level, format, values, 3, NULL);
+            }
+
+            void log(LogLevel level, const char *format, double v0, double v1, double v2, double v3) {
+                const double values[] = { v0, v1, v2, v3 };
+                push(level, format, values, 4, NULL);
+            }
+
+            void log(LogLevel level, const char *format, const double *values, uint32_t numberOfValues) {
+                push(level, format, values, numberOfValues, NULL);
+            }
+
+            // Appends a copy of text to the message.
+            void logText(LogLevel level, const char *format, const char *text) {
+                push(level, format, NULL, 0, text);
+            }
+
+            /**
+             * Moves every waiting record to sink. Only the writer may call this.
+             */
+            template<typename SINK>
+            uint32_t drain(SINK &sink) {
+                uint32_t drained = 0;
+                const uint32_t numberOfRings = min(static_cast<uint32_t>(MAX_THREADS), __atomic_load_n(&m_numberOfRings, __ATOMIC_ACQUIRE));
+                LogRecord record;
+                for (uint32_t i = 0; i < numberOfRings; i++) {
+                    while (m_rings[i].pop(record)) {
+                        sink(record);
+                        drained++;
+                    }
+                }
+                return drained;
+            }
+
+            // Records lost to full rings or to threads beyond MAX_THREADS.
+            uint64_t getDroppedRecords() const {
+                uint64_t dropped = __atomic_load_n(&m_unassigned, __ATOMIC_RELAXED);
+                const uint32_t numberOfRings = min(static_cast<uint32_t>(MAX_THREADS), __atomic_load_n(&m_numberOfRings, __ATOMIC_ACQUIRE));
+                for (uint32_t i = 0; i < numberOfRings; i++) {
+                    dropped += m_rings[i].getDropped();
+                }
+                return dropped;
+            }
+
+        private:
+            void push(LogLevel level, const char *format, const double *values, uint32_t numberOfValues, const char *text) {
+                if (!isEnabled(level)) {
+                    return;
+                }
+                LogRing *ring = ringOfThisThread();
+                if (ring == NULL) {
+                    __atomic_fetch_add(&m_unassigned, 1, __ATOMIC_RELAXED);
+                    return;
+                }
+                LogRecord record;
+                record.time = monotonicMicroseconds();
+                record.format = format;
+                record.level = level;
+                record.numberOfValues = min(numberOfValues, static_cast<uint32_t>(LogRecord::MAX_VALUES));
+                for (uint32_t i = 0; i < record.numberOfValues; i++) {
+                    record.values[i] = values[i];
+                }
+                record.text[0] = '\0';
+                if (text != NULL) {
+                    strncpy(record.text, text, LogRecord::MAX_TEXT - 1);
+                    record.text[LogRecord::MAX_TEXT - 1] = '\0';
+                }
+                ring->push(record);
+            }
+
+            LogRing* ringOfThisThread() {
+                if (threadLogRingOwner != this) {
+                    const uint32_t index = __atomic_fetch_add(&m_numberOfRings, 1, __ATOMIC_ACQ_REL);
+                    threadLogRing = (index < MAX_THREADS) ? &m_rings[index] : NULL;
+                    threadLogRingOwner = this;
+                }
+                return threadLogRing;
+            }
+
+            int32_t m_level;
+            uint32_t m_numberOfRings; // Claimed so far; may exceed MAX_THREADS.
+            uint64_t m_unassigned;
+            ostream *m_output;
+            LogRing m_rings[MAX_THREADS];
+    };
+
+    /**
+     * Formats one record as "[seconds] level message text". Values are
+     * printed exactly: whole numbers such as frame identities and time
+     * stamps as integers, all others with as many of the 17 digits of a
+     * double as it takes to read them back unchanged.
+     */
+    class LogFormatter {
+        public:
+            LogFormatter(stringstream &out) :
+                m_out(out) {}
+
+            void operator()(const LogRecord &record) {
+                m_out << "[" << (record.time / 1000000) << "." << static_cast<char>('0' + (record.time / 100000) % 10)
+                      << static_cast<char>('0' + (record.time / 10000) % 10) << static_cast<char>('0' + (record.time / 1000) % 10)
+                      << "] " << LOG_LEVEL_NAMES[record.level] << " ";
+                uint32_t value = 0;
+                for (const char *c = record.format; *c != '\0'; c++) {
+                    if ( (*c == '%') && (value < record.numberOfValues) ) {
+                        writeValue(record.values[value++]);
+                    }
+                    else {
+                        m_out << *c;
+                    }
+                }
+                m_out << record.text << "\n";
+            }
+
+        private:
+            void writeValue(const double v) {
+                // Doubles hold every integer up to 2^53 exactly.
+                if ( (v == floor(v)) && (fabs(v) < 9007199254740992.0) ) {
+                    m_out << static_cast<int64_t>(v);
+                    return;
+                }
+                // 15 digits unless the value needs all 17 to be read back unchanged.
+                char buffer[32];
+                snprintf(buffer, sizeof(buffer), "%.15g", v);
+                if (strtod(buffer, NULL) != v) {
+                    snprintf(buffer, sizeof(buffer), "%.17g", v);
+                }
+                m_out << buffer;
+            }
+
+            stringstream &m_out;
+    };
+
+    /**
+     * Background thread that formats the records of an AsyncLog and writes
+     * them in one go per pass, so only this thread ever waits for the output.
+     */
+    class AsyncLogWriter : public core::base::Service {
+        public:
+            AsyncLogWriter(AsyncLog &log, uint32_t interval) :
+                m_log(log),
+                m_interval(interval),
+                m_reportedDropped(0) {}
+
+            virtual void beforeStop() {}
+
+            virtual void run() {
+                serviceReady();
+                while (isRunning()) {
+                    if (writePending() == 0) {
+                        core::base::Thread::usleepFor(m_interval);
+                    }
+                }
+                writePending();
+            }
+
+        private:
+            uint32_t writePending() {
+                stringstream sstr;
+                LogFormatter formatter(sstr);
+                const uint32_t written = m_log.drain(formatter);
+                const uint64_t dropped = m_log.getDroppedRecords();
+                if (dropped != m_reportedDropped) {
+                    sstr << "Dropped " << (dropped - m_reportedDropped) << " log records." << "\n";
+                    m_reportedDropped = dropped;
+                }
+                const string text = sstr.str();
+                if (!text.empty()) {
+                    m_log.getOutput() << text << flush;
+                }
+                return written;
+            }
+
+            AsyncLog &m_log;
+            uint32_t m_interval; // Microseconds to sleep when there was nothing to write.
+            uint64_t m_reportedDropped;
+    };
+
+} // msv
+
+#endif /*ASYNCLOG_H_*/
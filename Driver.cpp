@@ -19,16 +19,31 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <pthread.h>
+#include <time.h>
 
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "core/base/AbstractDataStore.h"
+#include "core/base/KeyValueConfiguration.h"
+#include "core/base/KeyValueDataStore.h"
 #include "core/io/ContainerConference.h"
 #include "core/data/Container.h"
 #include "core/data/Constants.h"
+#include "core/data/TimeStamp.h"
 #include "core/data/control/VehicleControl.h"
 #include "core/data/environment/VehicleData.h"
 
 #include "GeneratedHeaders_Data.h"
 
+#include "AsyncLog.h"
 #include "Driver.h"
+#include "FrameLog.h"
+#include "LatencyHistogram.h"
+#include "SensorBoardLayout.h"
 
 namespace msv {
 
@@ -38,6 +53,230 @@ namespace msv {
         using namespace core::data::control;
         using namespace core::data::environment;
 
+        // Stages of one pass from reading lanedetector's data to sending the vehicle control.
+        enum DriverStage {
+            STAGE_READ = 0,
+            STAGE_COMPUTE,
+            STAGE_SEND,
+            STAGE_COMMAND_AGE, // From the camera sending the frame to reading the LaneFollowingCommand computed from it.
+            NUMBER_OF_DRIVER_STAGES
+        };
+
+        const char *DRIVER_STAGE_NAMES[NUMBER_OF_DRIVER_STAGES] = { "read", "compute", "send", "command_age" };
+        LatencyRecorder latency(DRIVER_STAGE_NAMES, NUMBER_OF_DRIVER_STAGES);
+        string latencyFile; // CSV file written at tearDown; empty to skip it.
+
+        // Messages from the control loop go through logger; logWriter writes them between setUp and tearDown.
+        AsyncLog logger;
+        ofstream logFile;
+        AsyncLogWriter *logWriter = NULL;
+
+        // Binary record of every computed command; open with driver.framelog.file.
+        FrameLogWriter frameLog;
+
+        // Returns the value for key or defaultValue if the configuration does not provide it.
+        template<typename T>
+        T getOptionalValue(const KeyValueConfiguration &kv, const string &key, const T &defaultValue) {
+            try {
+                return kv.getValue<T>(key);
+            }
+            catch(...) {
+                return defaultValue;
+            }
+        }
+
+        /**
+         * Wakes the control loop as soon as the conference delivers data a
+         * command is computed from. Registered as data store for those
+         * types, so add() runs on the conference's receiving thread; the
+         * containers themselves are still read from the KeyValueDataStore.
+         */
+        class DataArrival : public AbstractDataStore {
+            private:
+                /**
+                 * "Forbidden" copy constructor. Goal: The compiler should warn
+                 * already at compile time for unwanted bugs caused by any misuse
+                 * of the copy constructor.
+                 */
+                DataArrival(const DataArrival &);
+
+                /**
+                 * "Forbidden" assignment operator. Goal: The compiler should warn
+                 * already at compile time for unwanted bugs caused by any misuse
+                 * of the assignment operator.
+                 */
+                DataArrival& operator=(const DataArrival &);
+
+            public:
+                DataArrival() :
+                    m_mutex(),
+                    m_arrived(),
+                    m_pending(0) {
+                    pthread_mutex_init(&m_mutex, NULL);
+                    // Deadlines are monotonic: adjusting the wall clock must not stretch a wait.
+                    pthread_condattr_t attributes;
+                    pthread_condattr_init(&attributes);
+                    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+                    pthread_cond_init(&m_arrived, &attributes);
+                    pthread_condattr_destroy(&attributes);
+                }
+
+                virtual ~DataArrival() {
+                    pthread_cond_destroy(&m_arrived);
+                    pthread_mutex_destroy(&m_mutex);
+                }
+
+                virtual void add(const Container &/*container*/) {
+                    pthread_mutex_lock(&m_mutex);
+                    m_pending++;
+                    pthread_cond_signal(&m_arrived);
+                    pthread_mutex_unlock(&m_mutex);
+                }
+
+                virtual void clear() {
+                    pthread_mutex_lock(&m_mutex);
+                    m_pending = 0;
+                    pthread_mutex_unlock(&m_mutex);
+                }
+
+                virtual uint32_t getSize() const {
+                    return __atomic_load_n(&m_pending, __ATOMIC_RELAXED);
+                }
+
+                virtual bool isEmpty() const {
+                    return (getSize() == 0);
+                }
+
+                /**
+                 * Returns as soon as data has arrived since the last call, or
+                 * after at most microseconds; true if data has arrived.
+                 */
+                bool waitFor(int64_t microseconds) {
+                    struct timespec deadline;
+                    clock_gettime(CLOCK_MONOTONIC, &deadline);
+                    const int64_t nanoseconds = deadline.tv_nsec + (microseconds % 1000000) * 1000;
+                    deadline.tv_sec += static_cast<time_t>(microseconds / 1000000 + nanoseconds / 1000000000);
+                    deadline.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+
+                    pthread_mutex_lock(&m_mutex);
+                    while (m_pending == 0) {
+                        if (pthread_cond_timedwait(&m_arrived, &m_mutex, &deadline) != 0) {
+                            break;
+                        }
+                    }
+                    const bool arrived = (m_pending > 0);
+                    m_pending = 0;
+                    pthread_mutex_unlock(&m_mutex);
+                    return arrived;
+                }
+
+            private:
+                pthread_mutex_t m_mutex;
+                pthread_cond_t m_arrived;
+                uint32_t m_pending; // Containers added since the last waitFor().
+        };
+
+        // Registered for USER_DATA_1..3 in setUp; lives as long as the conference may deliver to it.
+        DataArrival dataArrival;
+
+        // Longest wait for new data, so that a module stop request is noticed even without deadlines.
+        const int64_t MAXIMUM_WAIT = 100000;
+
+        // Identifies a container by the time it was sent; a new value from lanedetector has a new time stamp.
+        int64_t containerIdentity(Container &c) {
+            const int64_t sent = c.getSentTimeStamp().toMicroseconds();
+            return (sent != 0 ? sent : c.getReceivedTimeStamp().toMicroseconds());
+        }
+
+        /**
+         * Updates readings from the most recent sensor board data, preferring
+         * the fixed layout SensorBoardReadings (USER_DATA_4) over the map
+         * based SensorBoardData (USER_DATA_0) that older sensor boards and
+         * recordings provide. A Container hands out its payload only by
+         * deserialising it from its stream, which allocates whatever the
+         * message; encodeSensorReadings/decodeSensorReadings cannot be used
+         * until the sensor board proxy shares raw readings. So a container is
+         * decoded only once, when it is new, and readings keeps it as plain
+         * data. Returns true if readings changed.
+         */
+        bool updateSensorReadings(KeyValueDataStore &kvds, int64_t &lastSensorData, SensorReadings &readings) {
+            Container containerSensorBoardReadings = kvds.get(Container::USER_DATA_4);
+            if (containerSensorBoardReadings.getDataType() == Container::USER_DATA_4) {
+                if (containerIdentity(containerSensorBoardReadings) == lastSensorData) {
+                    return false;
+                }
+                lastSensorData = containerIdentity(containerSensorBoardReadings);
+                readings = toSensorReadings(containerSensorBoardReadings.getData<SensorBoardReadings> ());
+                return true;
+            }
+            Container containerSensorBoardData = kvds.get(Container::USER_DATA_0);
+            if ( (containerSensorBoardData.getDataType() != Container::USER_DATA_0) || (containerIdentity(containerSensorBoardData) == lastSensorData) ) {
+                return false;
+            }
+            lastSensorData = containerIdentity(containerSensorBoardData);
+            readings = toSensorReadings(containerSensorBoardData.getData<SensorBoardData> ());
+            return true;
+        }
+
+        // Compares a serialisation round trip of SensorBoardData, SensorBoardReadings and the raw fixed layout.
+        void benchmarkSensorBoardCodec(uint32_t iterations) {
+            SensorReadings readings;
+            readings.numberOfSensors = 6;
+            for (uint32_t i = 0; i < readings.numberOfSensors; i++) {
+                readings.set(i, 10.0 + i);
+            }
+            SensorBoardData sbd;
+            sbd.setNumberOfSensors(readings.numberOfSensors);
+            for (uint32_t i = 0; i < readings.numberOfSensors; i++) {
+                sbd.putTo_MapOfDistances(i, readings.distances[i]);
+            }
+            const SensorBoardReadings sbr = toSensorBoardReadings(readings);
+
+            double checksum = 0;
+            int64_t start = monotonicMicroseconds();
+            for (uint32_t i = 0; i < iterations; i++) {
+                stringstream sstr;
+                sstr << Container(Container::USER_DATA_0, sbd);
+                Container c;
+                sstr >> c;
+                checksum += toSensorReadings(c.getData<SensorBoardData> ()).distances[1];
+            }
+            const int64_t mapTime = monotonicMicroseconds() - start;
+
+            start = monotonicMicroseconds();
+            for (uint32_t i = 0; i < iterations; i++) {
+                stringstream sstr;
+                sstr << Container(Container::USER_DATA_4, sbr);
+                Container c;
+                sstr >> c;
+                checksum += toSensorReadings(c.getData<SensorBoardReadings> ()).distances[1];
+            }
+            const int64_t fixedTime = monotonicMicroseconds() - start;
+
+            start = monotonicMicroseconds();
+            char buffer[SensorReadings::ENCODED_SIZE];
+            for (uint32_t i = 0; i < iterations; i++) {
+                SensorReadings decoded;
+                encodeSensorReadings(readings, buffer, sizeof(buffer));
+                decodeSensorReadings(buffer, sizeof(buffer), decoded);
+                checksum += decoded.distances[1];
+            }
+            const int64_t rawTime = monotonicMicroseconds() - start;
+
+            cerr << "Sensor board encode+decode per message: SensorBoardData " << (1000.0 * mapTime / iterations)
+                 << " ns, SensorBoardReadings " << (1000.0 * fixedTime / iterations)
+                 << " ns, fixed layout " << (1000.0 * rawTime / iterations) << " ns (checksum " << checksum << ")" << endl;
+        }
+
+        // Returns true if both commands make the vehicle do exactly the same.
+        bool isSameCommand(const VehicleControl &a, const VehicleControl &b) {
+            return (a.getSpeed() == b.getSpeed()) &&
+                   (a.getSteeringWheelAngle() == b.getSteeringWheelAngle()) &&
+                   (a.getBrakeLights() == b.getBrakeLights()) &&
+                   (a.getLeftFlashingLights() == b.getLeftFlashingLights()) &&
+                   (a.getRightFlashingLights() == b.getRightFlashingLights());
+        }
+
         Driver::Driver(const int32_t &argc, char **argv) :
             ConferenceClientModule(argc, argv, "Driver") {
         }
@@ -46,50 +285,173 @@ namespace msv {
 
         void Driver::setUp() {
             // This method will be call automatically _before_ running body().
+            KeyValueConfiguration kv = getKeyValueConfiguration();
+            // driver.log.level is debug, info, warning or error; driver.log.file replaces stderr.
+            LogLevel logLevel = LOG_INFO;
+            const string logLevelName = getOptionalValue<string>(kv, "driver.log.level", "info");
+            if (!parseLogLevel(logLevelName, logLevel)) {
+                cerr << "Unknown log level " << logLevelName << "; using info." << endl;
+            }
+            logger.setLevel(logLevel);
+            const string logFileName = getOptionalValue<string>(kv, "driver.log.file", "");
+            if (!logFileName.empty()) {
+                logFile.open(logFileName.c_str());
+                if (logFile.is_open()) {
+                    logger.setOutput(logFile);
+                }
+                else {
+                    cerr << "Could not open " << logFileName << "; logging to stderr." << endl;
+                }
+            }
+            logWriter = new AsyncLogWriter(logger, 1000);
+            logWriter->start();
+
+            // body() sleeps until lanedetector sends something or a deadline passes.
+            addDataStoreFor(Container::USER_DATA_1, dataArrival);
+            addDataStoreFor(Container::USER_DATA_2, dataArrival);
+            addDataStoreFor(Container::USER_DATA_3, dataArrival);
+
+            // driver.framelog.chunk records are preallocated at a time; flushes start every flushInterval ms.
+            const string frameLogFile = getOptionalValue<string>(kv, "driver.framelog.file", "");
+            if (!frameLogFile.empty() && !frameLog.open(frameLogFile, FRAME_LOG_DRIVER, getOptionalValue<uint32_t>(kv, "driver.framelog.chunk", 65536),
+                                                        getOptionalValue<int64_t>(kv, "driver.framelog.flushInterval", 1000) * 1000)) {
+                cerr << "Could not create the frame log " << frameLogFile << endl;
+            }
         }
 
         void Driver::tearDown() {
             // This method will be call automatically _after_ return from body().
+            if (logWriter != NULL) {
+                // Writes whatever is still waiting before the summary below.
+                logWriter->stop();
+                delete logWriter;
+                logWriter = NULL;
+            }
+            if (frameLog.isOpen()) {
+                cerr << "Frame log holds " << frameLog.getCount() << " commands." << endl;
+                frameLog.close();
+            }
+            cerr << latency.toString();
+            if (!latencyFile.empty() && !latency.writeCSV(latencyFile)) {
+                cerr << "Could not write latencies to " << latencyFile << endl;
+            }
         }
 
         // This method will do the main data processing job.
         ModuleState::MODULE_EXITCODE Driver::body() {
+            KeyValueConfiguration kv = getKeyValueConfiguration();
+            // A new command is computed when lanedetector sends new data or at the latest after one control period;
+            // with a control frequency of 0 at the latest when the keep-alive or the command timeout is due.
+            const double controlFrequency = getOptionalValue<double>(kv, "driver.controlFrequency", 20);
+            const int64_t controlPeriod = (controlFrequency > 0) ? static_cast<int64_t>(1000000 / controlFrequency) : 0;
+            // An unchanged command is repeated only after this many microseconds.
+            const int64_t keepAliveInterval = getOptionalValue<int64_t>(kv, "driver.keepAliveInterval", 100) * 1000;
+            // The received data is printed at most once per interval; 0 turns it off.
+            const int64_t diagnosticsInterval = getOptionalValue<int64_t>(kv, "driver.diagnosticsInterval", 1000) * 1000;
+            latencyFile = getOptionalValue<string>(kv, "driver.latency.csv", "");
+            // A command older than this many milliseconds, counted from the capture of its frame, is replaced by the
+            // safe command: brake lights on, steering driver.safe.steering and at most driver.safe.speed; 0 never does.
+            const int64_t commandTimeout = getOptionalValue<int64_t>(kv, "driver.commandTimeout", 250) * 1000;
+            const double safeSteering = getOptionalValue<double>(kv, "driver.safe.steering", 0);
+            const double safeSpeed = getOptionalValue<double>(kv, "driver.safe.speed", 0);
+
+            const uint32_t benchmarkIterations = getOptionalValue<uint32_t>(kv, "driver.benchmark.sensorboard", 0);
+            if (benchmarkIterations > 0) {
+                benchmarkSensorBoardCodec(benchmarkIterations);
+            }
+
+            int64_t lastCommandData = -1;
+            int64_t lastSteeringData = -1;
+            int64_t lastSpeedData = -1;
+            int64_t lastControl = 0;
+            int64_t lastCommandTime = 0;
+            int64_t lastSent = 0;
+            int64_t lastDiagnostics = 0;
+            int64_t lastSensorData = -1;
+            SensorReadings sensors;
+            bool hasSent = false;
+            VehicleControl lastVehicleControl;
+            uint32_t sentCommands = 0;
+            uint32_t suppressedCommands = 0;
+            uint32_t safeCommands = 0;
+            bool isSafe = false;
 
             while (getModuleState() == ModuleState::RUNNING) {
-                // In the following, you find example for the various data sources that are available:
-
-                // 1. Get most recent vehicle data:
-                Container containerVehicleData = getKeyValueDataStore().get(Container::VEHICLEDATA);
-                VehicleData vd = containerVehicleData.getData<VehicleData> ();
-                cerr << "Most recent vehicle data: '" << vd.toString() << "'" << endl;
-
-                // 2. Get most recent sensor board data:
-                Container containerSensorBoardData = getKeyValueDataStore().get(Container::USER_DATA_0);
-                SensorBoardData sbd = containerSensorBoardData.getData<SensorBoardData> ();
-                cerr << "Most recent sensor board data: '" << sbd.toString() << "'" << endl;
-
-                // 3. Get most recent user button data:
-                Container containerUserButtonData = getKeyValueDataStore().get(Container::USER_BUTTON);
-                UserButtonData ubd = containerUserButtonData.getData<UserButtonData> ();
-                cerr << "Most recent user button data: '" << ubd.toString() << "'" << endl;
-
-                // 4. Get most recent steering data as fill from lanedetector for example:
-                Container containerSteeringData = getKeyValueDataStore().get(Container::USER_DATA_1);
-                SteeringData sd = containerSteeringData.getData<SteeringData> ();
-                cerr << "Most recent steering data: '" << sd.toString() << "'" << endl;
-                
-                Container containerSpeedData = getKeyValueDataStore().get(Container::USER_DATA_2);
-                SpeedData spd = containerSpeedData.getData<SpeedData>();
-                cerr << "Most recent Speed data: '" << spd.toString() << "'" << endl;
+                const int64_t now = TimeStamp().toMicroseconds();
+
+                // 4. Get most recent command from lanedetector; steering and speed in it always belong to the same frame.
+                Container containerCommand = getKeyValueDataStore().get(Container::USER_DATA_3);
+                const bool hasCommand = (containerCommand.getDataType() == Container::USER_DATA_3);
+
+                // Older lanedetectors (like lanefollowing-old.cpp) send SteeringData and SpeedData separately.
+                Container containerSteeringData;
+                Container containerSpeedData;
+                if (!hasCommand) {
+                    containerSteeringData = getKeyValueDataStore().get(Container::USER_DATA_1);
+                    containerSpeedData = getKeyValueDataStore().get(Container::USER_DATA_2);
+                }
+
+                const bool hasNewData = hasCommand ?
+                                        (containerIdentity(containerCommand) != lastCommandData) :
+                                        ((containerIdentity(containerSteeringData) != lastSteeringData) ||
+                                         (containerIdentity(containerSpeedData) != lastSpeedData));
+                int64_t deadline = lastControl + ((controlPeriod > 0) ? controlPeriod : keepAliveInterval);
+                if ( !isSafe && (commandTimeout > 0) && (lastCommandTime > 0) ) {
+                    // Switch to the safe command as soon as the current one expires.
+                    deadline = min(deadline, lastCommandTime + commandTimeout + 1);
+                }
+                if (!hasNewData && (now < deadline)) {
+                    dataArrival.waitFor(min(deadline - now, MAXIMUM_WAIT));
+                    continue;
+                }
+                lastCommandData = containerIdentity(containerCommand);
+                lastSteeringData = containerIdentity(containerSteeringData);
+                lastSpeedData = containerIdentity(containerSpeedData);
+                lastControl = now;
+
+                const int64_t readStart = monotonicMicroseconds();
+                LaneFollowingCommand lfc;
+                // When the data the command is based on was produced; 0 if there is none at all.
+                int64_t commandTime = 0;
+                if (hasCommand) {
+                    lfc = containerCommand.getData<LaneFollowingCommand> ();
+                    const int64_t captured = static_cast<int64_t>(lfc.getCaptureSeconds()) * 1000000 + lfc.getCaptureMicroseconds();
+                    if (hasNewData && (captured > 0)) {
+                        latency.record(STAGE_COMMAND_AGE, now - captured);
+                    }
+                    commandTime = (captured > 0) ? captured : containerIdentity(containerCommand);
+                }
+                else {
+                    SteeringData sd = containerSteeringData.getData<SteeringData> ();
+                    SpeedData spd = containerSpeedData.getData<SpeedData>();
+                    lfc.setSteering(sd.getExampleData());
+                    lfc.setSpeed(spd.getSpeedData());
+                    if ( (containerSteeringData.getDataType() == Container::USER_DATA_1) && (containerSpeedData.getDataType() == Container::USER_DATA_2) ) {
+                        commandTime = min(containerIdentity(containerSteeringData), containerIdentity(containerSpeedData));
+                    }
+                }
+                lastCommandTime = commandTime;
+                const bool isStale = (commandTimeout > 0) && ( (commandTime <= 0) || (now - commandTime > commandTimeout) );
+                if (isStale != isSafe) {
+                    if (isStale) {
+                        logger.log(LOG_WARNING, "Lane following command is older than % ms; sending the safe command.", commandTimeout / 1000);
+                    }
+                    else {
+                        logger.log(LOG_INFO, "Lane following command is newer than % ms; following it again.", commandTimeout / 1000);
+                    }
+                    isSafe = isStale;
+                }
+                const int64_t computeStart = monotonicMicroseconds();
+                latency.record(STAGE_READ, computeStart - readStart);
 
                 // Create vehicle control data.
                 VehicleControl vc;
 
-                double speed = spd.getSpeedData(); //Set desired speed
+                double speed = lfc.getSpeed(); //Set desired speed
                 vc.setSpeed(speed);            
 
                     // With setSteeringWheelAngle, you can steer in the range of -26 (left) .. 0 (straight) .. +25 (right)
-                double steeringAngle = sd.getExampleData();
+                double steeringAngle = lfc.getSteering();
 
                 vc.setSteeringWheelAngle(steeringAngle * Constants::DEG2RAD);
 
@@ -98,10 +460,78 @@ namespace msv {
                 vc.setLeftFlashingLights(false);
                 vc.setRightFlashingLights(true);
 
-                // Create container for finally sending the data.
-                Container c(Container::VEHICLECONTROL, vc);
-                // Send container.
-                getConference().send(c);
+                if (isSafe) {
+                    // Nobody is looking at the lane any more: slow down and show it.
+                    vc.setSpeed(min(speed, safeSpeed));
+                    vc.setSteeringWheelAngle(safeSteering * Constants::DEG2RAD);
+                    vc.setBrakeLights(true);
+                    safeCommands++;
+                }
+                latency.record(STAGE_COMPUTE, monotonicMicroseconds() - computeStart);
+                logger.log(LOG_DEBUG, "Command: speed % steering % safe %", vc.getSpeed(), vc.getSteeringWheelAngle(), isSafe ? 1 : 0);
+
+                const bool send = !hasSent || !isSameCommand(vc, lastVehicleControl) || (now - lastSent >= keepAliveInterval);
+                if (frameLog.isOpen()) {
+                    FrameRecord record = emptyFrameRecord(FRAME_LOG_DRIVER);
+                    record.frameSequence = lfc.getFrameSequence();
+                    record.flags = (lfc.getIntersection() ? FRAME_INTERSECTION : 0) | (isSafe ? FRAME_SAFE_COMMAND : 0) | (send ? FRAME_SENT : 0) |
+                                   (vc.getBrakeLights() ? FRAME_BRAKE_LIGHTS : 0) | (vc.getLeftFlashingLights() ? FRAME_LEFT_FLASHING_LIGHTS : 0) |
+                                   (vc.getRightFlashingLights() ? FRAME_RIGHT_FLASHING_LIGHTS : 0);
+                    record.captured = hasCommand ? static_cast<int64_t>(lfc.getCaptureSeconds()) * 1000000 + lfc.getCaptureMicroseconds() : 0;
+                    record.logged = monotonicMicroseconds();
+                    record.steering = lfc.getSteering();
+                    record.speed = lfc.getSpeed();
+                    record.confidence = lfc.getConfidence();
+                    record.intersectionConfidence = lfc.getIntersectionConfidence();
+                    record.controlSpeed = vc.getSpeed();
+                    record.controlSteeringWheelAngle = vc.getSteeringWheelAngle();
+                    if (!frameLog.append(record)) {
+                        logger.log(LOG_ERROR, "Frame log could not grow; command for frame % is missing.", record.frameSequence);
+                    }
+                }
+
+                if (send) {
+                    const int64_t sendStart = monotonicMicroseconds();
+                    // Create container for finally sending the data.
+                    Container c(Container::VEHICLECONTROL, vc);
+                    // Send container.
+                    getConference().send(c);
+                    latency.record(STAGE_SEND, monotonicMicroseconds() - sendStart);
+
+                    lastVehicleControl = vc;
+                    lastSent = now;
+                    hasSent = true;
+                    sentCommands++;
+                }
+                else {
+                    suppressedCommands++;
+                }
+
+                if ( (diagnosticsInterval > 0) && (now - lastDiagnostics >= diagnosticsInterval) ) {
+                    lastDiagnostics = now;
+
+                    // In the following, you find example for the various data sources that are available:
+
+                    // 1. Get most recent vehicle data:
+                    Container containerVehicleData = getKeyValueDataStore().get(Container::VEHICLEDATA);
+                    VehicleData vd = containerVehicleData.getData<VehicleData> ();
+
+                    // 2. Get most recent sensor board data:
+                    updateSensorReadings(getKeyValueDataStore(), lastSensorData, sensors);
+
+                    // 3. Get most recent user button data:
+                    Container containerUserButtonData = getKeyValueDataStore().get(Container::USER_BUTTON);
+                    UserButtonData ubd = containerUserButtonData.getData<UserButtonData> ();
+
+                    // Only numbers are logged here; the writer thread formats them.
+                    logger.log(LOG_INFO, "Vehicle data: speed % heading % traveled path %", vd.getSpeed(), vd.getHeading(), vd.getAbsTraveledPath());
+                    logger.log(LOG_INFO, "Sensor board data: % sensors, valid mask %", sensors.numberOfSensors, sensors.validMask);
+                    logger.log(LOG_INFO, "Sensor board distances: % % % % % % % %", sensors.distances, SensorReadings::MAX_SENSORS);
+                    logger.log(LOG_INFO, "User button data: status % duration %", ubd.getButtonStatus(), ubd.getDuration());
+                    logger.log(LOG_INFO, "Lane following command: steering % speed % confidence % intersection %",
+                               lfc.getSteering(), lfc.getSpeed(), lfc.getConfidence(), lfc.getIntersectionConfidence());
+                    logger.log(LOG_INFO, "Sent % commands, suppressed % unchanged ones, % safe ones.", sentCommands, suppressedCommands, safeCommands);
+                }
             }
 
             return ModuleState::OKAY;
@@ -0,0 +1,490 @@
+/**
+ * FleetEvaluation.cpp - Replays many recordings through independent lane detectors on all cores.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "opencv2/core/core.hpp"
+
+#include "core/SharedPointer.h"
+#include "core/base/Lock.h"
+#include "core/base/Service.h"
+#include "core/data/Container.h"
+#include "core/data/image/SharedImage.h"
+#include "core/io/URL.h"
+#include "core/wrapper/SharedMemoryFactory.h"
+#include "tools/player/Player.h"
+#include "GeneratedHeaders_Data.h"
+
+#include "FleetEvaluation.h"
+#include "FrameBand.h"
+#include "InversePerspective.h"
+
+using namespace cv;
+
+namespace msv {
+
+    using namespace core::base;
+    using namespace core::data;
+    using namespace core::data::image;
+    using namespace tools::player;
+
+    FleetConfiguration::FleetConfiguration() :
+        workers(0),
+        tolerance(1),
+        memorySegmentSize(2800000),
+        numberOfSegments(20) {}
+
+    RecordingReport::RecordingReport() :
+        url(),
+        opened(false),
+        worker(0),
+        stolen(false),
+        frames(0),
+        duration(0),
+        readMicroseconds(0),
+        playerWaitMicroseconds(0),
+        frameLatency(),
+        compared(0),
+        agreeing(0),
+        sumOfDifferences(0),
+        maximumDifference(0),
+        intersectionDisagreements(0) {}
+
+    // Orders task indexes by decreasing size.
+    struct LargerTask {
+        const vector<uint64_t> *sizes;
+
+        bool operator()(uint32_t a, uint32_t b) const {
+            return (*sizes)[a] > (*sizes)[b];
+        }
+    };
+
+    TaskQueues::TaskQueues(const vector<uint64_t> &sizes, uint32_t numberOfWorkers) :
+        m_queues(max(1u, numberOfWorkers)),
+        m_mutexes() {
+        for (uint32_t i = 0; i < m_queues.size(); i++) {
+            m_mutexes.push_back(new Mutex());
+        }
+        vector<uint32_t> order(sizes.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        LargerTask larger = { &sizes };
+        stable_sort(order.begin(), order.end(), larger);
+
+        // Every task goes to the queue with the least work so far.
+        vector<uint64_t> load(m_queues.size(), 0);
+        for (uint32_t i = 0; i < order.size(); i++) {
+            const uint32_t q = static_cast<uint32_t>(min_element(load.begin(), load.end()) - load.begin());
+            m_queues[q].push_back(order[i]);
+            load[q] += max<uint64_t>(sizes[order[i]], 1);
+        }
+    }
+
+    TaskQueues::~TaskQueues() {
+        for (uint32_t i = 0; i < m_mutexes.size(); i++) {
+            delete m_mutexes[i];
+        }
+    }
+
+    bool TaskQueues::take(uint32_t worker, uint32_t &task, bool &stolen) {
+        stolen = false;
+        if (takeOwn(worker, task)) {
+            return true;
+        }
+        stolen = steal(worker, task);
+        return stolen;
+    }
+
+    bool TaskQueues::takeOwn(uint32_t worker, uint32_t &task) {
+        Lock l(*m_mutexes[worker]);
+        if (m_queues[worker].empty()) {
+            return false;
+        }
+        task = m_queues[worker].front();
+        m_queues[worker].pop_front();
+        return true;
+    }
+
+    bool TaskQueues::steal(uint32_t worker, uint32_t &task) {
+        // Tasks are never added, so a queue seen empty stays empty; retry until all are.
+        while (true) {
+            uint32_t victim = worker;
+            size_t most = 0;
+            for (uint32_t i = 0; i < m_queues.size(); i++) {
+                if (i == worker) {
+                    continue;
+                }
+                Lock l(*m_mutexes[i]);
+                if (m_queues[i].size() > most) {
+                    most = m_queues[i].size();
+                    victim = i;
+                }
+            }
+            if (victim == worker) {
+                return false;
+            }
+            Lock l(*m_mutexes[victim]);
+            if (!m_queues[victim].empty()) {
+                task = m_queues[victim].back();
+                m_queues[victim].pop_back();
+                return true;
+            }
+        }
+    }
+
+    // A frame's result waiting for the command recorded for the same frame.
+    struct FleetOutput {
+        int64_t captured;
+        double steering;
+        double speed;
+        bool intersection;
+    };
+
+    // Results older than this many frames have no recorded command and are not compared.
+    const uint32_t MAX_PENDING_OUTPUTS = 16;
+
+    uint64_t recordingSize(const string &url) {
+        struct stat s;
+        return (stat(core::io::URL(url).getResource().c_str(), &s) == 0) ? static_cast<uint64_t>(s.st_size) : 0;
+    }
+
+    // Replays the recordings of one queue, then steals from the others.
+    class FleetWorker : public Service {
+        public:
+            FleetWorker(FleetEvaluation &fleet, uint32_t id) :
+                m_fleet(fleet),
+                m_id(id) {}
+
+            virtual void beforeStop() {}
+
+            virtual void run() {
+                serviceReady();
+                uint32_t task = 0;
+                bool stolen = false;
+                while (isRunning() && m_fleet.m_queues->take(m_id, task, stolen)) {
+                    RecordingReport &report = m_fleet.m_reports[task];
+                    report.worker = m_id;
+                    report.stolen = stolen;
+                    evaluate(m_fleet.m_urls[task], report);
+                }
+                __atomic_sub_fetch(&m_fleet.m_activeWorkers, 1, __ATOMIC_RELEASE);
+            }
+
+        private:
+            // Copies the scanned band of the frame in c out of the Player's shared memory; the caller holds the Player mutex.
+            bool copyBand(Container &c, const LaneFeatureExtractor &extractor, Mat &band, FrameView &view) {
+                SharedImage si = c.getData<SharedImage> ();
+                if (!m_memory.isValid() || !m_memory->isValid() || (m_memoryName != si.getName())) {
+                    m_memory = core::wrapper::SharedMemoryFactory::attachToSharedMemory(si.getName());
+                    m_memoryName = si.getName();
+                }
+                if (!m_memory->isValid()) {
+                    return false;
+                }
+                const LaneFeatureExtractorConfiguration &configuration = m_fleet.m_extractorConfiguration;
+                FrameBandTimes times;
+                if (!copyFrameBand(*m_memory, si, configuration.roiTop - extractor.getEdgeMargin(), configuration.roiBottom + extractor.getEdgeMargin(),
+                                   band, view, times)) {
+                    return false;
+                }
+                view.captured = frameIdentity(c);
+                return true;
+            }
+
+            /**
+             * Compares a recorded command with the result for its frame and
+             * forgets everything up to that frame. Commands without a capture
+             * time belong to the newest frame; the intersection is only
+             * compared if the recording has it.
+             */
+            void compare(const int64_t captured, const double steering, const double speed, const bool *intersection,
+                         deque<FleetOutput> &pending, RecordingReport &report) const {
+                if (pending.empty()) {
+                    return;
+                }
+                int32_t match = static_cast<int32_t>(pending.size()) - 1;
+                if (captured > 0) {
+                    while ( (match >= 0) && (pending[match].captured != captured) ) {
+                        match--;
+                    }
+                    if (match < 0) {
+                        return;
+                    }
+                }
+                const FleetOutput &output = pending[match];
+                const double difference = fabs(output.steering - steering);
+                report.compared++;
+                report.agreeing += ( (difference <= m_fleet.m_configuration.tolerance) && (fabs(output.speed - speed) < 1e-6) ) ? 1 : 0;
+                report.sumOfDifferences += difference;
+                report.maximumDifference = max(report.maximumDifference, difference);
+                report.intersectionDisagreements += ( (intersection != NULL) && (output.intersection != *intersection) ) ? 1 : 0;
+                pending.erase(pending.begin(), pending.begin() + match + 1);
+            }
+
+            void evaluate(const string &url, RecordingReport &report) {
+                const int64_t taskStart = monotonicMicroseconds();
+                report.url = url;
+                // A detector of its own: tracks and steering state must not leak from one recording into another.
+                LaneFeatureExtractor extractor(m_fleet.m_extractorConfiguration);
+                extractor.setPerspective(m_fleet.m_perspective);
+                LaneFeatures features;
+                Mat band;
+                FrameView view;
+                deque<FleetOutput> pending;
+                bool hasCommands = false;
+                bool hasLegacySteering = false;
+                double legacySteering = 0;
+
+                Player *player = NULL;
+                {
+                    Lock l(m_fleet.m_playerMutex);
+                    // Every frame exactly once: no rewinding.
+                    player = new Player(core::io::URL(url), false, m_fleet.m_configuration.memorySegmentSize, m_fleet.m_configuration.numberOfSegments);
+                    report.opened = player->hasMoreData();
+                }
+
+                bool hasMoreData = report.opened;
+                while (isRunning() && hasMoreData) {
+                    const int64_t readStart = monotonicMicroseconds();
+                    Container c;
+                    bool hasFrame = false;
+                    {
+                        // Held only while the Player may write a frame into the shared memory and until its band is copied out.
+                        Lock l(m_fleet.m_playerMutex);
+                        report.playerWaitMicroseconds += monotonicMicroseconds() - readStart;
+                        c = player->getNextContainerToBeSent();
+                        if (c.getDataType() == Container::SHARED_IMAGE) {
+                            hasFrame = copyBand(c, extractor, band, view);
+                        }
+                    }
+                    hasMoreData = player->hasMoreData();
+                    const int64_t readEnd = monotonicMicroseconds();
+                    report.readMicroseconds += readEnd - readStart;
+
+                    if (c.getDataType() == Container::USER_DATA_3) {
+                        LaneFollowingCommand lfc = c.getData<LaneFollowingCommand> ();
+                        const int64_t captured = static_cast<int64_t>(lfc.getCaptureSeconds()) * 1000000 + lfc.getCaptureMicroseconds();
+                        const bool intersection = lfc.getIntersection();
+                        compare(captured, lfc.getSteering(), lfc.getSpeed(), &intersection, pending, report);
+                        hasCommands = true;
+                    }
+                    // Recordings of the old lanedetector only have SteeringData followed by SpeedData for every frame.
+                    else if ( (c.getDataType() == Container::USER_DATA_1) && !hasCommands ) {
+                        legacySteering = c.getData<SteeringData> ().getExampleData();
+                        hasLegacySteering = true;
+                    }
+                    else if ( (c.getDataType() == Container::USER_DATA_2) && !hasCommands && hasLegacySteering ) {
+                        compare(0, legacySteering, c.getData<SpeedData> ().getSpeedData(), NULL, pending, report);
+                        hasLegacySteering = false;
+                    }
+                    if (!hasFrame) {
+                        continue;
+                    }
+
+                    view.acquired = readEnd;
+                    extractor.extract(view, features);
+                    report.frameLatency.add(monotonicMicroseconds() - readEnd);
+                    report.frames++;
+
+                    FleetOutput output;
+                    output.captured = view.captured;
+                    output.steering = features.steering;
+                    output.speed = features.speed;
+                    output.intersection = features.intersection;
+                    pending.push_back(output);
+                    if (pending.size() > MAX_PENDING_OUTPUTS) {
+                        pending.pop_front();
+                    }
+                }
+
+                {
+                    Lock l(m_fleet.m_playerMutex);
+                    delete player;
+                    m_memory = core::SharedPointer<core::wrapper::SharedMemory>();
+                    m_memoryName.clear();
+                }
+                report.duration = monotonicMicroseconds() - taskStart;
+            }
+
+            FleetEvaluation &m_fleet;
+            uint32_t m_id;
+            core::SharedPointer<core::wrapper::SharedMemory> m_memory;
+            string m_memoryName;
+    };
+
+    FleetEvaluation::FleetEvaluation(const LaneFeatureExtractorConfiguration &extractorConfiguration, const InversePerspectiveMap *perspective,
+                                     const FleetConfiguration &configuration) :
+        m_extractorConfiguration(extractorConfiguration),
+        m_perspective(perspective),
+        m_configuration(configuration),
+        m_playerMutex(),
+        m_urls(),
+        m_reports(),
+        m_queues(NULL),
+        m_workers(),
+        m_numberOfWorkers(0),
+        m_activeWorkers(0),
+        m_start(0),
+        m_duration(0) {}
+
+    FleetEvaluation::~FleetEvaluation() {
+        stop();
+    }
+
+    void FleetEvaluation::start(const vector<string> &urls) {
+        stop();
+        m_urls = urls;
+        m_reports.assign(urls.size(), RecordingReport());
+        vector<uint64_t> sizes(urls.size());
+        for (uint32_t i = 0; i < urls.size(); i++) {
+            m_reports[i].url = urls[i];
+            sizes[i] = recordingSize(urls[i]);
+        }
+
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        uint32_t workers = (m_configuration.workers > 0) ? m_configuration.workers : static_cast<uint32_t>(max(1L, cores));
+        workers = max(1u, min(workers, static_cast<uint32_t>(urls.size())));
+
+        m_queues = new TaskQueues(sizes, workers);
+        m_numberOfWorkers = workers;
+        m_activeWorkers = workers;
+        m_start = monotonicMicroseconds();
+        for (uint32_t i = 0; i < workers; i++) {
+            m_workers.push_back(new FleetWorker(*this, i));
+            m_workers.back()->start();
+        }
+    }
+
+    bool FleetEvaluation::isFinished() const {
+        return __atomic_load_n(&m_activeWorkers, __ATOMIC_ACQUIRE) == 0;
+    }
+
+    vector<RecordingReport> FleetEvaluation::stop() {
+        if (m_queues == NULL) {
+            return m_reports;
+        }
+        for (uint32_t i = 0; i < m_workers.size(); i++) {
+            m_workers[i]->stop();
+            delete m_workers[i];
+        }
+        m_workers.clear();
+        m_duration = monotonicMicroseconds() - m_start;
+        delete m_queues;
+        m_queues = NULL;
+        return m_reports;
+    }
+
+    uint32_t FleetEvaluation::getNumberOfWorkers() const {
+        return m_numberOfWorkers;
+    }
+
+    int64_t FleetEvaluation::getDuration() const {
+        return m_duration;
+    }
+
+    const FleetConfiguration& FleetEvaluation::getConfiguration() const {
+        return m_configuration;
+    }
+
+    // Throughput, latency and agreement of one recording or of the whole fleet.
+    void describe(stringstream &sstr, uint32_t frames, int64_t duration, const LatencyHistogram &frameLatency,
+                  uint32_t compared, uint32_t agreeing, double sumOfDifferences, double maximumDifference, uint32_t intersectionDisagreements) {
+        const double seconds = duration / 1e6;
+        sstr << frames << " frames in " << seconds << " s (" << (seconds > 0 ? frames / seconds : 0) << " frames/s), extraction p50="
+             << frameLatency.getPercentile(50) << "us p99=" << frameLatency.getPercentile(99) << "us max=" << frameLatency.getMaximum() << "us";
+        if (compared > 0) {
+            sstr << ", agrees with the recorded commands in " << agreeing << " of " << compared << " frames ("
+                 << (100.0 * agreeing / compared) << "%), mean |steering difference| " << (sumOfDifferences / compared)
+                 << ", maximum " << maximumDifference << ", intersections disagree in " << intersectionDisagreements << " frames";
+        }
+        else {
+            sstr << ", no recorded commands to compare with";
+        }
+    }
+
+    string describeFleet(const vector<RecordingReport> &reports, int64_t duration, uint32_t workers) {
+        stringstream sstr;
+        LatencyHistogram frameLatency;
+        uint32_t frames = 0;
+        uint32_t compared = 0;
+        uint32_t agreeing = 0;
+        uint32_t intersectionDisagreements = 0;
+        uint32_t stolen = 0;
+        double sumOfDifferences = 0;
+        double maximumDifference = 0;
+        int64_t busy = 0;
+        int64_t reading = 0;
+        int64_t waiting = 0;
+        for (uint32_t i = 0; i < reports.size(); i++) {
+            const RecordingReport &r = reports[i];
+            sstr << r.url << ": ";
+            if (!r.opened) {
+                sstr << "could not be replayed." << endl;
+                continue;
+            }
+            describe(sstr, r.frames, r.duration, r.frameLatency, r.compared, r.agreeing, r.sumOfDifferences, r.maximumDifference, r.intersectionDisagreements);
+            sstr << "; worker " << r.worker << (r.stolen ? " (stolen)" : "") << "." << endl;
+
+            frameLatency.merge(r.frameLatency);
+            frames += r.frames;
+            compared += r.compared;
+            agreeing += r.agreeing;
+            intersectionDisagreements += r.intersectionDisagreements;
+            stolen += r.stolen ? 1 : 0;
+            sumOfDifferences += r.sumOfDifferences;
+            maximumDifference = max(maximumDifference, r.maximumDifference);
+            busy += r.duration;
+            reading += r.readMicroseconds;
+            waiting += r.playerWaitMicroseconds;
+        }
+        sstr << "Fleet of " << reports.size() << " recordings on " << workers << " workers: ";
+        describe(sstr, frames, duration, frameLatency, compared, agreeing, sumOfDifferences, maximumDifference, intersectionDisagreements);
+        sstr << "." << endl;
+        sstr << "Parallel speed-up " << (duration > 0 ? static_cast<double>(busy) / duration : 0) << "x, "
+             << (busy > 0 ? 100.0 * reading / busy : 0) << "% of the work spent reading recordings ("
+             << (busy > 0 ? 100.0 * waiting / busy : 0) << "% waiting for other workers' Players), "
+             << stolen << " recordings stolen." << endl;
+        return sstr.str();
+    }
+
+    bool writeFleetCSV(const vector<RecordingReport> &reports, const string &fileName) {
+        ofstream out(fileName.c_str());
+        if (!out.good()) {
+            return false;
+        }
+        out << "recording,opened,worker,stolen,frames,duration_us,read_us,player_wait_us,p50_us,p99_us,max_us,compared,agreeing,mean_difference,max_difference,intersection_disagreements" << "\n";
+        for (uint32_t i = 0; i < reports.size(); i++) {
+            const RecordingReport &r = reports[i];
+            out << r.url << "," << (r.opened ? 1 : 0) << "," << r.worker << "," << (r.stolen ? 1 : 0) << "," << r.frames << ","
+                << r.duration << "," << r.readMicroseconds << "," << r.playerWaitMicroseconds << "," << r.frameLatency.getPercentile(50) << ","
+                << r.frameLatency.getPercentile(99) << "," << r.frameLatency.getMaximum() << "," << r.compared << ","
+                << r.agreeing << "," << (r.compared > 0 ? r.sumOfDifferences / r.compared : 0) << "," << r.maximumDifference << ","
+                << r.intersectionDisagreements << "\n";
+        }
+        return out.good();
+    }
+
+} // msv
@@ -0,0 +1,197 @@
+/**
+ * FleetEvaluation.h - Replays many recordings through independent lane detectors on all cores.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef FLEETEVALUATION_H_
+#define FLEETEVALUATION_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "core/base/Mutex.h"
+
+#include "LaneFeatureExtractor.h"
+#include "LatencyHistogram.h"
+
+namespace msv {
+
+    using namespace std;
+
+    class InversePerspectiveMap;
+
+    struct FleetConfiguration {
+        FleetConfiguration();
+
+        uint32_t workers;           // Threads replaying recordings; 0 uses one per online core.
+        double tolerance;           // Degrees of steering difference still counted as agreement.
+        uint32_t memorySegmentSize; // Buffers of every recording's Player (global.buffer.*).
+        uint32_t numberOfSegments;
+    };
+
+    /**
+     * Outcome of replaying one recording. Steering is compared with the
+     * LaneFollowingCommands recorded next to the frames, i.e. with what the
+     * lanedetector on the car decided when the recording was made, or with
+     * the SteeringData and SpeedData of recordings made before there were
+     * LaneFollowingCommands; those have no intersections to compare.
+     */
+    struct RecordingReport {
+        RecordingReport();
+
+        string url;
+        bool opened;                        // False if the recording could not be read at all.
+        uint32_t worker;                    // Worker that replayed it.
+        bool stolen;                        // Taken from another worker's queue.
+        uint32_t frames;
+        int64_t duration;                   // Wall time of the whole task in microseconds.
+        int64_t readMicroseconds;           // Part of duration spent reading the recording, including waits for other workers.
+        int64_t playerWaitMicroseconds;     // Part of readMicroseconds spent waiting for the Player mutex.
+        LatencyHistogram frameLatency;      // Feature extraction per frame.
+        uint32_t compared;                  // Frames with a recorded command.
+        uint32_t agreeing;                  // Compared frames within the tolerance and with the same speed.
+        double sumOfDifferences;            // Of |steering - recorded steering|.
+        double maximumDifference;
+        uint32_t intersectionDisagreements;
+    };
+
+    /**
+     * Work-stealing task queues: every worker takes tasks from the front of
+     * its own queue, largest first, and once that is empty steals from the
+     * back of the fullest other queue, where the smallest tasks wait. Tasks
+     * are whole recordings, so a mutex per queue costs nothing noticeable.
+     */
+    class TaskQueues {
+        private:
+            /**
+             * "Forbidden" copy constructor. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the copy constructor.
+             */
+            TaskQueues(const TaskQueues &);
+
+            /**
+             * "Forbidden" assignment operator. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the assignment operator.
+             */
+            TaskQueues& operator=(const TaskQueues &);
+
+        public:
+            /**
+             * Deals tasks 0 .. sizes.size() - 1 out to numberOfWorkers queues,
+             * largest first, so that every queue starts with a similar load.
+             */
+            TaskQueues(const vector<uint64_t> &sizes, uint32_t numberOfWorkers);
+
+            ~TaskQueues();
+
+            // Returns false once no queue holds a task any longer; stolen tells where task came from.
+            bool take(uint32_t worker, uint32_t &task, bool &stolen);
+
+        private:
+            bool takeOwn(uint32_t worker, uint32_t &task);
+            bool steal(uint32_t worker, uint32_t &task);
+
+            vector<deque<uint32_t> > m_queues;
+            vector<core::base::Mutex*> m_mutexes;
+    };
+
+    class FleetWorker;
+
+    /**
+     * Replays every recording once, each one by a detector of its own
+     * configured like the one in the car, spread over worker threads.
+     */
+    class FleetEvaluation {
+        private:
+            /**
+             * "Forbidden" copy constructor. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the copy constructor.
+             */
+            FleetEvaluation(const FleetEvaluation &);
+
+            /**
+             * "Forbidden" assignment operator. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the assignment operator.
+             */
+            FleetEvaluation& operator=(const FleetEvaluation &);
+
+        public:
+            FleetEvaluation(const LaneFeatureExtractorConfiguration &extractorConfiguration, const InversePerspectiveMap *perspective,
+                            const FleetConfiguration &configuration);
+
+            ~FleetEvaluation();
+
+            // Starts the workers on urls; returns immediately.
+            void start(const vector<string> &urls);
+
+            // True once every recording has been replayed.
+            bool isFinished() const;
+
+            /**
+             * Stops the workers, abandoning recordings still being replayed,
+             * and returns one report per url in the order of urls.
+             */
+            vector<RecordingReport> stop();
+
+            uint32_t getNumberOfWorkers() const;
+
+            // Wall time from start to stop in microseconds.
+            int64_t getDuration() const;
+
+            const FleetConfiguration& getConfiguration() const;
+
+        private:
+            friend class FleetWorker;
+
+            LaneFeatureExtractorConfiguration m_extractorConfiguration;
+            const InversePerspectiveMap *m_perspective;
+            FleetConfiguration m_configuration;
+            /**
+             * Reading from Players is serialised. A Player replays every frame
+             * into a shared memory segment named after the recorded
+             * SharedImage, so Players of recordings made with the same camera
+             * write into the same segment in this process. Which segment is
+             * written is only known once getNextContainerToBeSent() has
+             * returned, so one mutex covers reading a container and copying
+             * its band out; extraction and comparison run unlocked.
+             */
+            core::base::Mutex m_playerMutex;
+            vector<string> m_urls;
+            vector<RecordingReport> m_reports;
+            TaskQueues *m_queues;
+            vector<FleetWorker*> m_workers;
+            uint32_t m_numberOfWorkers;
+            uint32_t m_activeWorkers; // Workers that have not run out of tasks yet.
+            int64_t m_start;
+            int64_t m_duration;
+    };
+
+    // Per recording and aggregate throughput, latency and steering agreement.
+    string describeFleet(const vector<RecordingReport> &reports, int64_t duration, uint32_t workers);
+
+    // One line per recording; returns false if fileName cannot be written.
+    bool writeFleetCSV(const vector<RecordingReport> &reports, const string &fileName);
+
+} // msv
+
+#endif /*FLEETEVALUATION_H_*/
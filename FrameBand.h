@@ -0,0 +1,111 @@
+/**
+ * FrameBand.h - Locating and copying the scanned rows of a camera frame in shared memory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef FRAMEBAND_H_
+#define FRAMEBAND_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "opencv2/core/core.hpp"
+
+#include "core/data/Container.h"
+#include "core/data/image/SharedImage.h"
+#include "core/wrapper/SharedMemoryFactory.h"
+
+#include "LaneFeatureExtractor.h"
+#include "LatencyHistogram.h"
+
+namespace msv {
+
+    using namespace std;
+
+    // Identifies a frame by the time its container was sent; the camera sends every frame exactly once.
+    inline int64_t frameIdentity(core::data::Container &c) {
+        const int64_t sent = c.getSentTimeStamp().toMicroseconds();
+        return (sent != 0 ? sent : c.getReceivedTimeStamp().toMicroseconds());
+    }
+
+    // Rows of the raw (unmirrored) shared image that make up the processed band.
+    struct FrameBand {
+        int32_t top;     // First frame row.
+        int32_t rows;
+        uint32_t offset; // Byte offset of the band in the shared memory.
+        uint32_t bytes;
+    };
+
+    // Microseconds copyFrameBand waited for the shared memory lock and spent copying.
+    struct FrameBandTimes {
+        int64_t lockWait;
+        int64_t copy;
+    };
+
+    // Locates frame rows [top, bottom], clamped to the frame, in the BGR shared image si.
+    inline bool locateFrameBand(const core::data::image::SharedImage &si, int32_t top, int32_t bottom, FrameBand &band) {
+        const uint32_t numberOfChannels = 3;
+        top = max(0, top);
+        bottom = min(static_cast<int32_t>(si.getHeight()) - 1, bottom);
+        if ( (si.getBytesPerPixel() != numberOfChannels) || (top > bottom) ) {
+            return false;
+        }
+        // The camera delivers the frame rotated by 180 degrees, so frame rows [top, bottom]
+        // are the contiguous raw rows [height - 1 - bottom, height - 1 - top].
+        const uint32_t rowBytes = si.getWidth() * numberOfChannels;
+        band.top = top;
+        band.rows = bottom - top + 1;
+        band.offset = (si.getHeight() - 1 - bottom) * rowBytes;
+        band.bytes = band.rows * rowBytes;
+        return true;
+    }
+
+    /**
+     * Copies frame rows [top, bottom] of si out of memory into target,
+     * holding the lock only for the memcpy, and lets view describe them.
+     * view.captured is left to the caller.
+     */
+    inline bool copyFrameBand(core::wrapper::SharedMemory &memory, const core::data::image::SharedImage &si, int32_t top, int32_t bottom,
+                              cv::Mat &target, FrameView &view, FrameBandTimes &times) {
+        FrameBand band;
+        if (!locateFrameBand(si, top, bottom, band) || (memory.getSize() < band.offset + band.bytes)) {
+            return false;
+        }
+        if ( (target.rows != band.rows) || (target.cols != static_cast<int32_t>(si.getWidth())) || (target.type() != CV_8UC3) ) {
+            target.create(band.rows, si.getWidth(), CV_8UC3);
+        }
+
+        const int64_t start = monotonicMicroseconds();
+        memory.lock();
+        const int64_t locked = monotonicMicroseconds();
+        memcpy(target.data, static_cast<char*>(memory.getSharedMemory()) + band.offset, band.bytes);
+        memory.unlock();
+        times.lockWait = locked - start;
+        times.copy = monotonicMicroseconds() - locked;
+
+        view.pixels = target;
+        view.firstRow = band.top;
+        view.mirrored = true;
+        view.scale = 1;
+        view.acquired = start;
+        return true;
+    }
+
+} // msv
+
+#endif /*FRAMEBAND_H_*/
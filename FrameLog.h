@@ -0,0 +1,396 @@
+/**
+ * FrameLog.h - Fixed-size binary records of what lanedetector saw and driver sent, one per frame.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef FRAMELOG_H_
+#define FRAMELOG_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include "LatencyHistogram.h"
+
+namespace msv {
+
+    using namespace std;
+
+    enum FrameLogSource {
+        FRAME_LOG_LANEDETECTOR = 1,
+        FRAME_LOG_DRIVER = 2
+    };
+
+    enum FrameRecordFlags {
+        FRAME_INTERSECTION = 1 << 0,        // The lane following command flags an intersection.
+        FRAME_SAFE_COMMAND = 1 << 1,        // Driver replaced a stale command by the safe one.
+        FRAME_SENT = 1 << 2,                // Driver sent the VehicleControl; otherwise it was suppressed as unchanged.
+        FRAME_BRAKE_LIGHTS = 1 << 3,
+        FRAME_LEFT_FLASHING_LIGHTS = 1 << 4,
+        FRAME_RIGHT_FLASHING_LIGHTS = 1 << 5
+    };
+
+    /**
+     * One frame as lanedetector saw it or one command as driver computed it.
+     * The layout is fixed (160 bytes, little endian as written) so that a
+     * record is found by its index alone.
+     */
+    struct FrameRecord {
+        enum {
+            MAX_SCANLINES = 16,
+            NO_HIT = -1
+        };
+
+        uint32_t frameSequence;          // Of the LaneFollowingCommand.
+        uint32_t flags;                  // FrameRecordFlags.
+        int64_t captured;                // Time stamp of the camera frame in microseconds.
+        int64_t logged;                  // monotonicMicroseconds() when the record was appended.
+        float steering;                  // LaneFollowingCommand.
+        float speed;
+        float confidence;
+        float intersectionConfidence;
+        float controlSpeed;              // VehicleControl sent by driver; 0 in lanedetector records.
+        float controlSteeringWheelAngle; // In radians.
+        uint16_t numberOfScanlines;      // Entries used in row, left and right; 0 in driver records.
+        uint16_t source;                 // FrameLogSource.
+        int16_t row[MAX_SCANLINES];      // Frame row of each scanline.
+        int16_t left[MAX_SCANLINES];     // Column of the left hit; NO_HIT (-1) if there is none.
+        int16_t right[MAX_SCANLINES];    // Column of the right hit; the frame width if there is none (as in LaneFeatures).
+        uint8_t reserved[12];
+    };
+
+    struct FrameLogHeader {
+        enum {
+            VERSION = 1
+        };
+
+        char magic[8];         // "MSVFRLOG"
+        uint32_t version;
+        uint32_t recordSize;   // sizeof(FrameRecord) of the writer.
+        uint32_t source;       // FrameLogSource.
+        uint32_t maxScanlines;
+        uint64_t count;        // Complete records; updated after each record is in place.
+        int64_t created;       // Wall clock time of creation in microseconds since the epoch.
+        uint8_t reserved[24];
+    };
+
+    // Compile time checks of the layout: an array of negative size does not compile.
+    typedef char FrameRecordMustHave160Bytes[(sizeof(FrameRecord) == 160) ? 1 : -1];
+    typedef char FrameLogHeaderMustHave64Bytes[(sizeof(FrameLogHeader) == 64) ? 1 : -1];
+
+    const char FRAME_LOG_MAGIC[8] = { 'M', 'S', 'V', 'F', 'R', 'L', 'O', 'G' };
+
+    // A record with no scanlines; unused scanline entries are NO_HIT.
+    inline FrameRecord emptyFrameRecord(FrameLogSource source) {
+        FrameRecord record;
+        memset(&record, 0, sizeof(record));
+        record.source = source;
+        for (uint32_t i = 0; i < FrameRecord::MAX_SCANLINES; i++) {
+            record.left[i] = record.right[i] = FrameRecord::NO_HIT;
+        }
+        return record;
+    }
+
+    /**
+     * Appends FrameRecords to a file through a shared memory mapping. The file
+     * is preallocated in chunks of records, so appending is a copy into memory;
+     * only growing by another chunk and the periodic flush call into the kernel,
+     * and the flush merely starts the write-back. Single writer only.
+     */
+    class FrameLogWriter {
+        private:
+            /**
+             * "Forbidden" copy constructor. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the copy constructor.
+             */
+            FrameLogWriter(const FrameLogWriter &);
+
+            /**
+             * "Forbidden" assignment operator. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the assignment operator.
+             */
+            FrameLogWriter& operator=(const FrameLogWriter &);
+
+        public:
+            FrameLogWriter() :
+                m_file(-1),
+                m_memory(NULL),
+                m_capacity(0),
+                m_count(0),
+                m_chunk(0),
+                m_flushInterval(0),
+                m_lastFlush(0),
+                m_flushed(0) {}
+
+            ~FrameLogWriter() {
+                close();
+            }
+
+            /**
+             * Creates (or truncates) fileName for chunk records at first. flushInterval
+             * is the number of microseconds between flushes; 0 leaves it to the kernel.
+             */
+            bool open(const string &fileName, FrameLogSource source, uint32_t chunk, int64_t flushInterval) {
+                close();
+                m_file = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                if (m_file < 0) {
+                    return false;
+                }
+                m_chunk = max(1u, chunk);
+                m_flushInterval = flushInterval;
+                if (!map(m_chunk)) {
+                    close();
+                    return false;
+                }
+                FrameLogHeader &header = getHeader();
+                memset(&header, 0, sizeof(header));
+                memcpy(header.magic, FRAME_LOG_MAGIC, sizeof(header.magic));
+                header.version = FrameLogHeader::VERSION;
+                header.recordSize = sizeof(FrameRecord);
+                header.source = source;
+                header.maxScanlines = FrameRecord::MAX_SCANLINES;
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                header.created = static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_usec;
+                m_lastFlush = monotonicMicroseconds();
+                return true;
+            }
+
+            bool isOpen() const {
+                return m_memory != NULL;
+            }
+
+            uint64_t getCount() const {
+                return m_count;
+            }
+
+            // Returns false if the file could not grow; the record is lost then.
+            bool append(const FrameRecord &record) {
+                if (m_memory == NULL) {
+                    return false;
+                }
+                if ( (m_count == m_capacity) && !map(m_capacity + m_chunk) ) {
+                    return false;
+                }
+                memcpy(m_memory + sizeof(FrameLogHeader) + m_count * sizeof(FrameRecord), &record, sizeof(FrameRecord));
+                m_count++;
+                // A reader mapping the file while it is written never sees a half written record.
+                __atomic_store_n(&getHeader().count, m_count, __ATOMIC_RELEASE);
+
+                if (m_flushInterval > 0) {
+                    const int64_t now = monotonicMicroseconds();
+                    if (now - m_lastFlush >= m_flushInterval) {
+                        flush();
+                        m_lastFlush = now;
+                    }
+                }
+                return true;
+            }
+
+            // Writes everything, cuts the unused part of the last chunk off and closes the file.
+            void close() {
+                if (m_memory != NULL) {
+                    msync(m_memory, mappedBytes(m_capacity), MS_SYNC);
+                    munmap(m_memory, mappedBytes(m_capacity));
+                    m_memory = NULL;
+                    if (ftruncate(m_file, mappedBytes(m_count)) != 0) {
+                        // The unused records stay in the file; readers go by the count in the header.
+                    }
+                }
+                if (m_file >= 0) {
+                    ::close(m_file);
+                    m_file = -1;
+                }
+                m_capacity = m_count = m_flushed = 0;
+            }
+
+        private:
+            static size_t mappedBytes(uint64_t records) {
+                return sizeof(FrameLogHeader) + records * sizeof(FrameRecord);
+            }
+
+            FrameLogHeader& getHeader() {
+                return *reinterpret_cast<FrameLogHeader*>(m_memory);
+            }
+
+            // Makes the file hold capacity records and maps all of it.
+            bool map(uint64_t capacity) {
+                if (posix_fallocate(m_file, 0, mappedBytes(capacity)) != 0) {
+                    return false;
+                }
+                if (m_memory != NULL) {
+                    munmap(m_memory, mappedBytes(m_capacity));
+                    m_memory = NULL;
+                }
+                void *memory = mmap(NULL, mappedBytes(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+                if (memory == MAP_FAILED) {
+                    return false;
+                }
+                m_memory = static_cast<char*>(memory);
+                m_capacity = capacity;
+                return true;
+            }
+
+            // Starts writing the records appended since the last flush and the header back to the file.
+            void flush() {
+                const size_t from = mappedBytes(m_flushed);
+                const size_t to = mappedBytes(m_count);
+#if defined(__linux__)
+                sync_file_range(m_file, from, to - from, SYNC_FILE_RANGE_WRITE);
+                sync_file_range(m_file, 0, sizeof(FrameLogHeader), SYNC_FILE_RANGE_WRITE);
+#else
+                const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                msync(m_memory + (from / page) * page, to - (from / page) * page, MS_ASYNC);
+                msync(m_memory, sizeof(FrameLogHeader), MS_ASYNC);
+#endif
+                m_flushed = m_count;
+            }
+
+            int m_file;
+            char *m_memory;
+            uint64_t m_capacity; // Records the file has room for.
+            uint64_t m_count;
+            uint32_t m_chunk;
+            int64_t m_flushInterval;
+            int64_t m_lastFlush;
+            uint64_t m_flushed;  // Records handed to the kernel for writing.
+    };
+
+    /**
+     * Maps a frame log read-only; every record is then a pointer access.
+     * A log that is still being written can be opened; it shows the records
+     * complete at the time of open().
+     */
+    class FrameLogReader {
+        private:
+            /**
+             * "Forbidden" copy constructor. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the copy constructor.
+             */
+            FrameLogReader(const FrameLogReader &);
+
+            /**
+             * "Forbidden" assignment operator. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the assignment operator.
+             */
+            FrameLogReader& operator=(const FrameLogReader &);
+
+        public:
+            FrameLogReader() :
+                m_memory(NULL),
+                m_bytes(0),
+                m_count(0) {}
+
+            ~FrameLogReader() {
+                close();
+            }
+
+            // Returns false if fileName is not a frame log of this version.
+            bool open(const string &fileName) {
+                close();
+                const int file = ::open(fileName.c_str(), O_RDONLY);
+                if (file < 0) {
+                    return false;
+                }
+                struct stat s;
+                if ( (fstat(file, &s) != 0) || (static_cast<size_t>(s.st_size) < sizeof(FrameLogHeader)) ) {
+                    ::close(file);
+                    return false;
+                }
+                void *memory = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, file, 0);
+                // The mapping stays valid without the descriptor.
+                ::close(file);
+                if (memory == MAP_FAILED) {
+                    return false;
+                }
+                m_memory = static_cast<const char*>(memory);
+                m_bytes = s.st_size;
+
+                const FrameLogHeader &header = getHeader();
+                if ( (memcmp(header.magic, FRAME_LOG_MAGIC, sizeof(header.magic)) != 0) || (header.version != FrameLogHeader::VERSION) ||
+                     (header.recordSize != sizeof(FrameRecord)) ) {
+                    close();
+                    return false;
+                }
+                m_count = min(__atomic_load_n(&header.count, __ATOMIC_ACQUIRE), static_cast<uint64_t>((m_bytes - sizeof(FrameLogHeader)) / sizeof(FrameRecord)));
+                return true;
+            }
+
+            void close() {
+                if (m_memory != NULL) {
+                    munmap(const_cast<char*>(m_memory), m_bytes);
+                    m_memory = NULL;
+                }
+                m_bytes = 0;
+                m_count = 0;
+            }
+
+            bool isOpen() const {
+                return m_memory != NULL;
+            }
+
+            const FrameLogHeader& getHeader() const {
+                return *reinterpret_cast<const FrameLogHeader*>(m_memory);
+            }
+
+            uint64_t getCount() const {
+                return m_count;
+            }
+
+            const FrameRecord& getRecord(uint64_t index) const {
+                return reinterpret_cast<const FrameRecord*>(m_memory + sizeof(FrameLogHeader))[index];
+            }
+
+            /**
+             * Index of the first record captured at or after captured, by binary
+             * search; getCount() if there is none. Records are appended in
+             * capture order, so this finds a moment in a long run directly.
+             */
+            uint64_t findCaptured(int64_t captured) const {
+                uint64_t first = 0;
+                uint64_t last = m_count;
+                while (first < last) {
+                    const uint64_t middle = first + (last - first) / 2;
+                    if (getRecord(middle).captured < captured) {
+                        first = middle + 1;
+                    }
+                    else {
+                        last = middle;
+                    }
+                }
+                return first;
+            }
+
+        private:
+            const char *m_memory;
+            size_t m_bytes;
+            uint64_t m_count;
+    };
+
+} // msv
+
+#endif /*FRAMELOG_H_*/
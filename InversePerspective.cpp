@@ -0,0 +1,160 @@
+/**
+ * InversePerspective.cpp - Bird's-eye view of the scanned band from a calibrated camera.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "opencv2/core/core.hpp"
+
+#include "InversePerspective.h"
+#include <math.h>
+
+using namespace cv;
+
+namespace msv {
+
+    PerspectiveCalibration::PerspectiveCalibration() :
+        width(640),
+        height(480),
+        focalX(500),
+        focalY(500),
+        centreX(320),
+        centreY(240),
+        cameraHeight(0.15),
+        pitch(4.57),
+        lateralRange(0.4),
+        metresPerPixel(0),
+        rows(16) {}
+
+    InversePerspectiveMap::InversePerspectiveMap() :
+        m_calibration(),
+        m_rows(0),
+        m_columns(0),
+        m_metresPerPixel(0),
+        m_distances(),
+        m_table() {}
+
+    // Metres ahead on the floor seen by frame row y; 0 if the ray through it does not reach the floor.
+    double floorDistance(const PerspectiveCalibration &c, double pitch, double y) {
+        const double t = (y - c.centreY) / c.focalY;
+        const double denominator = t * cos(pitch) + sin(pitch);
+        return (denominator > 0) ? c.cameraHeight * (cos(pitch) - t * sin(pitch)) / denominator : 0;
+    }
+
+    int16_t toFixedPoint(double v) {
+        return static_cast<int16_t>(max(-32768.0, min(32767.0, floor(v * 16 + 0.5))));
+    }
+
+    bool InversePerspectiveMap::compile(const PerspectiveCalibration &calibration, int32_t top, int32_t bottom) {
+        const PerspectiveCalibration &c = calibration;
+        m_calibration = calibration;
+        m_rows = m_columns = 0;
+        m_distances.clear();
+        m_table.clear();
+
+        const double pitch = c.pitch * CV_PI / 180;
+        const double nearest = floorDistance(c, pitch, bottom);
+        const double farthest = floorDistance(c, pitch, top);
+        if ( (c.rows <= 0) || (c.lateralRange <= 0) || (nearest <= 0) || (farthest <= nearest) ) {
+            return false;
+        }
+        // Depth along the optical axis of a floor point at distance z.
+        const double nearestDepth = nearest * cos(pitch) + c.cameraHeight * sin(pitch);
+        m_metresPerPixel = (c.metresPerPixel > 0) ? c.metresPerPixel : nearestDepth / c.focalX;
+        m_rows = c.rows;
+        m_columns = 2 * static_cast<int32_t>(ceil(c.lateralRange / m_metresPerPixel));
+
+        // Row 0 is the farthest one, as in the frame.
+        m_distances.resize(m_rows);
+        m_table.resize(m_rows * m_columns);
+        for (int32_t v = 0; v < m_rows; v++) {
+            const double z = farthest + (nearest - farthest) * (v + 0.5) / m_rows;
+            const double depth = z * cos(pitch) + c.cameraHeight * sin(pitch);
+            const double y = c.centreY + c.focalY * (c.cameraHeight * cos(pitch) - z * sin(pitch)) / depth;
+            m_distances[v] = z;
+            for (int32_t u = 0; u < m_columns; u++) {
+                RemapEntry &entry = m_table[v * m_columns + u];
+                entry.x = toFixedPoint(c.centreX + c.focalX * getLateral(u) / depth);
+                entry.y = toFixedPoint(y);
+            }
+        }
+        return true;
+    }
+
+    bool InversePerspectiveMap::isCompiled() const {
+        return !m_table.empty();
+    }
+
+    const PerspectiveCalibration& InversePerspectiveMap::getCalibration() const {
+        return m_calibration;
+    }
+
+    int32_t InversePerspectiveMap::getRows() const {
+        return m_rows;
+    }
+
+    int32_t InversePerspectiveMap::getColumns() const {
+        return m_columns;
+    }
+
+    int32_t InversePerspectiveMap::getCentreColumn() const {
+        return m_columns / 2;
+    }
+
+    double InversePerspectiveMap::getLateral(int32_t column) const {
+        return (column - m_columns / 2 + 0.5) * m_metresPerPixel;
+    }
+
+    double InversePerspectiveMap::getDistance(int32_t row) const {
+        return m_distances[row];
+    }
+
+    Point InversePerspectiveMap::toFrame(const Point &strip) const {
+        const RemapEntry &entry = m_table[strip.y * m_columns + strip.x];
+        return Point((entry.x + 8) >> 4, (entry.y + 8) >> 4);
+    }
+
+    bool InversePerspectiveMap::bind(const FrameView &view, vector<int32_t> &offsets) const {
+        offsets.assign(m_table.size(), -1);
+        if (view.pixels.cols * view.scale != m_calibration.width) {
+            return false;
+        }
+        for (int32_t v = 0; v < m_rows; v++) {
+            for (int32_t u = 0; u < m_columns; u++) {
+                const Point p = toViewPixels(view, toFrame(Point(u, v)));
+                if ( (p.x >= 0) && (p.x < view.pixels.cols) && (p.y >= 0) && (p.y < view.pixels.rows) ) {
+                    offsets[v * m_columns + u] = p.y * static_cast<int32_t>(view.pixels.step) + p.x;
+                }
+            }
+        }
+        return true;
+    }
+
+    void InversePerspectiveMap::warp(const Mat &source, const vector<int32_t> &offsets, Mat &strip) const {
+        strip.create(m_rows, m_columns, CV_8UC1);
+        if ( (offsets.size() != m_table.size()) || offsets.empty() ) {
+            strip.setTo(Scalar::all(0));
+            return;
+        }
+        const uchar *in = source.data;
+        uchar *out = strip.data;
+        const int32_t *offset = &offsets[0];
+        const int32_t size = m_rows * m_columns;
+        for (int32_t i = 0; i < size; i++) {
+            out[i] = (offset[i] >= 0) ? in[offset[i]] : 0;
+        }
+    }
+
+} // msv
@@ -0,0 +1,116 @@
+/**
+ * InversePerspective.h - Bird's-eye view of the scanned band from a calibrated camera.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef INVERSEPERSPECTIVE_H_
+#define INVERSEPERSPECTIVE_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "LaneFeatureExtractor.h"
+
+namespace msv {
+
+    using namespace std;
+
+    // Pinhole camera looking at a flat floor, and the layout of the bird's-eye strip computed from it.
+    struct PerspectiveCalibration {
+        PerspectiveCalibration();
+
+        int32_t width;         // Frame size the intrinsics are given for.
+        int32_t height;
+        double focalX;         // Focal lengths in pixels.
+        double focalY;
+        double centreX;        // Principal point in (upright) frame pixels.
+        double centreY;
+        double cameraHeight;   // Metres above the floor.
+        double pitch;          // Degrees the optical axis points below the horizon.
+        double lateralRange;   // Metres covered on either side of the optical axis.
+        double metresPerPixel; // Lateral size of a strip pixel; 0 matches the frame pixels at the nearest row.
+        int32_t rows;          // Strip rows, evenly spaced in distance over the band; each one is a scanline.
+    };
+
+    // Frame position of a strip pixel in 1/16 pixels (Q11.4).
+    struct RemapEntry {
+        int16_t x;
+        int16_t y;
+    };
+
+    /**
+     * Maps the floor in front of the car to a strip of rows at known
+     * distances and columns at known lateral offsets. All geometry is
+     * compiled once into a fixed-point table; a frame then only costs
+     * one gather through offsets bound to the storage of its edge map.
+     */
+    class InversePerspectiveMap {
+        public:
+            InversePerspectiveMap();
+
+            /**
+             * Builds the table for the frame rows [top, bottom]. Returns
+             * false if the camera does not see the floor in these rows.
+             */
+            bool compile(const PerspectiveCalibration &calibration, int32_t top, int32_t bottom);
+
+            bool isCompiled() const;
+
+            const PerspectiveCalibration& getCalibration() const;
+
+            int32_t getRows() const;
+
+            int32_t getColumns() const;
+
+            // Strip column straight ahead of the camera.
+            int32_t getCentreColumn() const;
+
+            // Metres right of the optical axis seen by a strip column.
+            double getLateral(int32_t column) const;
+
+            // Metres ahead of the camera seen by a strip row.
+            double getDistance(int32_t row) const;
+
+            // Frame pixel seen by a strip pixel.
+            cv::Point toFrame(const cv::Point &strip) const;
+
+            /**
+             * Turns the table into byte offsets into the storage of view.pixels; strip
+             * pixels view does not hold get -1. Returns false if view is not a frame
+             * of the calibrated width.
+             */
+            bool bind(const FrameView &view, vector<int32_t> &offsets) const;
+
+            /**
+             * Fills strip (getRows() x getColumns(), single channel) from source through offsets from bind.
+             */
+            void warp(const cv::Mat &source, const vector<int32_t> &offsets, cv::Mat &strip) const;
+
+        private:
+            PerspectiveCalibration m_calibration;
+            int32_t m_rows;
+            int32_t m_columns;
+            double m_metresPerPixel;
+            vector<double> m_distances;
+            vector<RemapEntry> m_table;
+    };
+
+} // msv
+
+#endif /*INVERSEPERSPECTIVE_H_*/
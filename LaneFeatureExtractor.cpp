@@ -0,0 +1,1253 @@
+/**
+ * LaneFeatureExtractor.cpp - Lane marking features and lane following commands from camera frames.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <iostream>
+#include <vector>
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "InversePerspective.h"
+#include "LaneFeatureExtractor.h"
+#include "LatencyHistogram.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    // Also declares the AVX2 intrinsics for kernels compiled with target("avx2") in a baseline build.
+    #include <immintrin.h>
+    #define GRADIENT_AVX2_AT_RUNTIME
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+#endif
+
+using namespace cv;
+
+namespace msv {
+
+    const char *EDGE_DETECTOR_NAMES[NUMBER_OF_EDGE_DETECTORS] = { "canny", "fused", "threshold" };
+
+    const char* getEdgeDetectorName(EdgeDetector detector) {
+        return EDGE_DETECTOR_NAMES[detector];
+    }
+
+    bool parseEdgeDetector(const string &name, EdgeDetector &detector) {
+        for (int32_t i = 0; i < NUMBER_OF_EDGE_DETECTORS; i++) {
+            if (name == EDGE_DETECTOR_NAMES[i]) {
+                detector = static_cast<EdgeDetector>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    LaneFeatureExtractorConfiguration::LaneFeatureExtractorConfiguration() :
+        scanlines(),
+        tracking(),
+        roiTop(275),
+        roiBottom(350),
+        edgeDetector(EDGES_CANNY),
+        cannyLowThreshold(50),
+        cannyHighThreshold(170),
+        cannyAperture(3),
+        downscale(1),
+        refineHits(false),
+        edgeThreshold(170),
+        gradientKernel(),
+        markingThreshold(),
+        intersection(),
+        metricSteering() {
+        // The four scanlines the steering rule was tuned for; the original rule never looked at the third one.
+        scanlines.numberOfScanlines = 4;
+        scanlines.firstRow = 275;
+        scanlines.spacing = 25;
+        scanlines.startColumn = -1;
+        const int32_t leftThresholds[] = { 214, 191, -1, 145 };
+        scanlines.leftThresholds.assign(leftThresholds, leftThresholds + 4);
+        scanlines.rightLostColumn = 500;
+        scanlines.laneOffset = 214;
+        scanlines.desiredDistRight = 211;
+        scanlines.parallelThreshold = 16;
+
+        tracking.enabled = false;
+        tracking.window = 16;
+        tracking.alpha = 0.5;
+        tracking.beta = 0.1;
+        tracking.maxMisses = 3;
+
+        findGradientKernel("auto", gradientKernel);
+
+        markingThreshold.high = 0.6;
+        markingThreshold.low = 0.3;
+        markingThreshold.minContrast = 40;
+        markingThreshold.minWidth = 4;
+
+        intersection.enabled = true;
+        intersection.probes = 5;
+        intersection.halfWidth = 100;
+        intersection.minFill = 0.6;
+        intersection.threshold = 0.6;
+
+        // Where the steering rule wants the right line on scanline 0 with the default calibration.
+        metricSteering.desiredRight = 0.21;
+        metricSteering.gain = 50;
+    }
+
+    FrameView cropView(const FrameView &view, int32_t top, int32_t bottom) {
+        top = max(top, view.firstRow);
+        bottom = min(bottom, view.firstRow + view.pixels.rows - 1);
+
+        FrameView cropped;
+        cropped.firstRow = top;
+        cropped.mirrored = view.mirrored;
+        cropped.scale = view.scale;
+        cropped.acquired = view.acquired;
+        cropped.captured = view.captured;
+        if (view.mirrored) {
+            const int32_t last = view.firstRow + view.pixels.rows - 1;
+            cropped.pixels = view.pixels.rowRange(last - bottom, last - top + 1);
+        }
+        else {
+            cropped.pixels = view.pixels.rowRange(top - view.firstRow, bottom - view.firstRow + 1);
+        }
+        return cropped;
+    }
+
+    // Integer division rounding towards minus infinity, so that points just outside of a reduced view stay outside.
+    int32_t floorDivide(int32_t a, int32_t b) {
+        return (a >= 0 ? a / b : -((b - 1 - a) / b));
+    }
+
+    Point toViewPixels(const FrameView &view, const Point &p) {
+        const int32_t s = view.scale;
+        if (view.mirrored) {
+            return Point(floorDivide(view.pixels.cols * s - 1 - p.x, s), floorDivide(view.firstRow + view.pixels.rows * s - 1 - p.y, s));
+        }
+        return Point(floorDivide(p.x, s), floorDivide(p.y - view.firstRow, s));
+    }
+
+    Point fromViewPixels(const FrameView &view, const Point &p) {
+        const int32_t s = view.scale;
+        if (view.mirrored) {
+            return Point(view.pixels.cols * s - 1 - p.x * s, view.firstRow + view.pixels.rows * s - 1 - p.y * s);
+        }
+        return Point(p.x * s, p.y * s + view.firstRow);
+    }
+
+/*-----------Nicolas--------------*/
+    // Result of searching one edge row for the nearest edge pixel.
+    struct EdgeHit {
+        int32_t x;  // Column of the edge pixel; -1 (left) or cols (right) if there is none.
+        bool found;
+    };
+
+    EdgeHit makeEdgeHit(int32_t x, bool found) {
+        EdgeHit hit;
+        hit.x = x;
+        hit.found = found;
+        return hit;
+    }
+
+    // Pixel by pixel reference of the search; also handles the tails the vector loops leave over.
+    EdgeHit findEdgeRightScalar(const uchar *row, int32_t cols, int32_t x) {
+        for (int32_t i = max(x + 1, 0); i < cols; i++) {
+            if (row[i] != 0) {
+                return makeEdgeHit(i, true);
+            }
+        }
+        return makeEdgeHit(cols, false);
+    }
+
+    EdgeHit findEdgeLeftScalar(const uchar *row, int32_t cols, int32_t x) {
+        for (int32_t i = min(x - 1, cols - 1); i >= 0; i--) {
+            if (row[i] != 0) {
+                return makeEdgeHit(i, true);
+            }
+        }
+        return makeEdgeHit(-1, false);
+    }
+
+#if defined(__AVX2__)
+    // Finds the first non-zero byte in row to the right of x, 32 pixels per step.
+    EdgeHit findEdgeRight(const uchar *row, int32_t cols, int32_t x) {
+        const __m256i zero = _mm256_setzero_si256();
+        int32_t i = max(x + 1, 0);
+        for (; i + 32 <= cols; i += 32) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+            const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)));
+            if (mask != 0) {
+                return makeEdgeHit(i + __builtin_ctz(mask), true);
+            }
+        }
+        return findEdgeRightScalar(row, cols, i - 1);
+    }
+
+    // Finds the first non-zero byte in row to the left of x, 32 pixels per step.
+    EdgeHit findEdgeLeft(const uchar *row, int32_t cols, int32_t x) {
+        const __m256i zero = _mm256_setzero_si256();
+        int32_t i = min(x, cols); // Exclusive end of the not yet searched part.
+        for (; i - 32 >= 0; i -= 32) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i - 32));
+            const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)));
+            if (mask != 0) {
+                return makeEdgeHit(i - 1 - __builtin_clz(mask), true);
+            }
+        }
+        return findEdgeLeftScalar(row, cols, i);
+    }
+#elif defined(__SSE2__)
+    // Finds the first non-zero byte in row to the right of x, 16 pixels per step.
+    EdgeHit findEdgeRight(const uchar *row, int32_t cols, int32_t x) {
+        const __m128i zero = _mm_setzero_si128();
+        int32_t i = max(x + 1, 0);
+        for (; i + 16 <= cols; i += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+            const uint32_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xFFFF;
+            if (mask != 0) {
+                return makeEdgeHit(i + __builtin_ctz(mask), true);
+            }
+        }
+        return findEdgeRightScalar(row, cols, i - 1);
+    }
+
+    // Finds the first non-zero byte in row to the left of x, 16 pixels per step.
+    EdgeHit findEdgeLeft(const uchar *row, int32_t cols, int32_t x) {
+        const __m128i zero = _mm_setzero_si128();
+        int32_t i = min(x, cols); // Exclusive end of the not yet searched part.
+        for (; i - 16 >= 0; i -= 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - 16));
+            const uint32_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xFFFF;
+            if (mask != 0) {
+                return makeEdgeHit(i - 16 + 31 - __builtin_clz(mask), true);
+            }
+        }
+        return findEdgeLeftScalar(row, cols, i);
+    }
+#else
+    EdgeHit findEdgeRight(const uchar *row, int32_t cols, int32_t x) {
+        return findEdgeRightScalar(row, cols, x);
+    }
+
+    EdgeHit findEdgeLeft(const uchar *row, int32_t cols, int32_t x) {
+        return findEdgeLeftScalar(row, cols, x);
+    }
+#endif
+
+    int32_t countEdgePixelsScalar(const uchar *row, int32_t begin, int32_t end) {
+        int32_t count = 0;
+        for (int32_t i = begin; i < end; i++) {
+            count += (row[i] != 0) ? 1 : 0;
+        }
+        return count;
+    }
+
+#if defined(__AVX2__)
+    // Counts the non-zero bytes in row[begin, end), 32 pixels per step.
+    int32_t countEdgePixels(const uchar *row, int32_t begin, int32_t end) {
+        const __m256i zero = _mm256_setzero_si256();
+        int32_t count = 0;
+        int32_t i = begin;
+        for (; i + 32 <= end; i += 32) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+            count += 32 - __builtin_popcount(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero))));
+        }
+        return count + countEdgePixelsScalar(row, i, end);
+    }
+#elif defined(__SSE2__)
+    // Counts the non-zero bytes in row[begin, end), 16 pixels per step.
+    int32_t countEdgePixels(const uchar *row, int32_t begin, int32_t end) {
+        const __m128i zero = _mm_setzero_si128();
+        int32_t count = 0;
+        int32_t i = begin;
+        for (; i + 16 <= end; i += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+            count += 16 - __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+        }
+        return count + countEdgePixelsScalar(row, i, end);
+    }
+#else
+    int32_t countEdgePixels(const uchar *row, int32_t begin, int32_t end) {
+        return countEdgePixelsScalar(row, begin, end);
+    }
+#endif
+
+    // Turns a hit in the storage of view.pixels into a frame column. A block of a reduced resolution
+    // view maps to its frame column nearest to where the search came from.
+    EdgeHit toFrameHit(const FrameView &view, EdgeHit hit, bool pixelRight, bool right) {
+        const int32_t cols = view.pixels.cols * view.scale;
+        if (!hit.found) {
+            return (right ? makeEdgeHit(cols, false) : makeEdgeHit(-1, false));
+        }
+        const int32_t column = (pixelRight ? hit.x * view.scale : hit.x * view.scale + view.scale - 1);
+        hit.x = (view.mirrored ? cols - 1 - column : column);
+        return hit;
+    }
+
+    // Searches the edge map of view from point (frame coordinates) to the right or left.
+    // The returned x is in frame coordinates, too.
+    EdgeHit findEdge(const FrameView &view, const Point &point, bool right) {
+        const Point p = toViewPixels(view, point);
+        const int32_t cols = view.pixels.cols;
+        // Mirroring swaps left and right.
+        const bool pixelRight = (view.mirrored ? !right : right);
+        if (p.y < 0 || p.y >= view.pixels.rows) {
+            // The scanline lies outside of the processed band.
+            return toFrameHit(view, makeEdgeHit(-1, false), pixelRight, right);
+        }
+        const uchar *row = view.pixels.ptr<uchar>(p.y);
+        const EdgeHit hit = (pixelRight ? findEdgeRight(row, cols, p.x) : findEdgeLeft(row, cols, p.x));
+        return toFrameHit(view, hit, pixelRight, right);
+    }
+
+    // Searches from point to the right or left like findEdge, but only within the frame columns [lo, hi].
+    EdgeHit findEdgeInWindow(const FrameView &view, const Point &point, bool right, int32_t lo, int32_t hi) {
+        const int32_t cols = view.pixels.cols * view.scale;
+        const EdgeHit notFound = (right ? makeEdgeHit(cols, false) : makeEdgeHit(-1, false));
+        const Point p = toViewPixels(view, point);
+        if (p.y < 0 || p.y >= view.pixels.rows) {
+            return notFound;
+        }
+
+        // Only the part of the window on the searched side of point counts.
+        if (right) {
+            lo = max(lo, point.x + 1);
+        }
+        else {
+            hi = min(hi, point.x - 1);
+        }
+        lo = max(lo, 0);
+        hi = min(hi, cols - 1);
+        if (lo > hi) {
+            return notFound;
+        }
+
+        // Window and direction in the storage of view.pixels.
+        const int32_t pixelLo = toViewPixels(view, Point(view.mirrored ? hi : lo, point.y)).x;
+        const int32_t pixelHi = toViewPixels(view, Point(view.mirrored ? lo : hi, point.y)).x;
+        const bool pixelRight = (view.mirrored ? !right : right);
+        const uchar *row = view.pixels.ptr<uchar>(p.y);
+
+        EdgeHit hit;
+        if (pixelRight) {
+            hit = findEdgeRight(row, pixelHi + 1, pixelLo - 1);
+        }
+        else {
+            hit = findEdgeLeft(row + pixelLo, pixelHi + 1 - pixelLo, pixelHi + 1 - pixelLo);
+            hit.x += pixelLo;
+        }
+        return toFrameHit(view, hit, pixelRight, right);
+    }
+
+    // Tries the window around the predicted column first and scans the whole side only if that misses.
+    EdgeHit findTrackedEdge(const FrameView &view, const Point &point, bool right, const LaneTrack &track, const TrackingParameters &tracking) {
+        if (track.valid) {
+            const int32_t predicted = cvRound(track.position + track.velocity);
+            const EdgeHit hit = findEdgeInWindow(view, point, right, predicted - tracking.window, predicted + tracking.window);
+            if (hit.found) {
+                return hit;
+            }
+        }
+        return findEdge(view, point, right);
+    }
+
+    // Feeds a new hit into track and returns the column to steer with.
+    int32_t updateTrack(LaneTrack &track, const EdgeHit &hit, const TrackingParameters &tracking) {
+        if (!hit.found) {
+            // Coast on the prediction for a few frames; the steering rule sees the line as lost.
+            track.position += track.velocity;
+            track.misses++;
+            track.valid = track.valid && (track.misses <= tracking.maxMisses);
+            return hit.x;
+        }
+
+        if (!track.valid) {
+            track.position = hit.x;
+            track.velocity = 0;
+            track.valid = true;
+        }
+        else {
+            const double predicted = track.position + track.velocity;
+            const double residual = hit.x - predicted;
+            track.position = predicted + tracking.alpha * residual;
+            track.velocity += tracking.beta * residual;
+        }
+        track.misses = 0;
+        return cvRound(track.position);
+    }
+
+    // Luma of a BGR pixel with the weights of CV_BGR2GRAY in 8 bit fixed point.
+    inline uint32_t lumaOf(const uchar *bgr) {
+        return 29 * bgr[0] + 150 * bgr[1] + 77 * bgr[2];
+    }
+
+    // Writes the first cols pixels of row y of the gray image of bgr reduced by SCALE: converts BGR to gray
+    // and averages blocks of SCALE x SCALE pixels in the same pass, so that no full resolution gray image is written.
+    template<int32_t SCALE>
+    void grayRow(const Mat &bgr, int32_t y, uchar *out, int32_t cols) {
+        const uint32_t half = 128 * SCALE * SCALE; // rounds to nearest
+        for (int32_t x = 0; x < cols; x++) {
+            uint32_t sum = half;
+            for (int32_t dy = 0; dy < SCALE; dy++) {
+                const uchar *in = bgr.ptr<uchar>(y * SCALE + dy) + 3 * x * SCALE;
+                for (int32_t dx = 0; dx < SCALE; dx++) {
+                    sum += lumaOf(in + 3 * dx);
+                }
+            }
+            out[x] = static_cast<uchar>(sum / (256 * SCALE * SCALE));
+        }
+    }
+
+    // gray must have bgr.rows / SCALE rows and bgr.cols / SCALE columns.
+    template<int32_t SCALE>
+    void downscaleToGray(const Mat &bgr, Mat &gray) {
+        for (int32_t y = 0; y < gray.rows; y++) {
+            grayRow<SCALE>(bgr, y, gray.ptr<uchar>(y), gray.cols);
+        }
+    }
+
+    // Pixel by pixel reference of the gradient row; also handles the tails the vector loops leave over.
+    void gradientRowTail(const uchar *a, const uchar *r, const uchar *b, uchar *edges, int32_t x, int32_t cols, int32_t threshold) {
+        for (; x < cols - 1; x++) {
+            const int32_t gx = (a[x + 1] - a[x - 1]) + 2 * (r[x + 1] - r[x - 1]) + (b[x + 1] - b[x - 1]);
+            const int32_t gy = (b[x - 1] + 2 * b[x] + b[x + 1]) - (a[x - 1] + 2 * a[x] + a[x + 1]);
+            edges[x] = (abs(gx) + abs(gy) >= threshold) ? 255 : 0;
+        }
+    }
+
+    void gradientRowScalar(const uchar *a, const uchar *r, const uchar *b, uchar *edges, int32_t cols, int32_t threshold) {
+        edges[0] = edges[cols - 1] = 0;
+        gradientRowTail(a, r, b, edges, 1, cols, threshold);
+    }
+
+#if defined(__SSE2__)
+    // Sobel L1 magnitude of 8 pixels from their 16 bit neighbourhood.
+    inline __m128i sobelMagnitudeSSE2(__m128i a0, __m128i a1, __m128i a2, __m128i r0, __m128i r2, __m128i b0, __m128i b1, __m128i b2) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i gx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(a2, a0), _mm_sub_epi16(b2, b0)), _mm_slli_epi16(_mm_sub_epi16(r2, r0), 1));
+        const __m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(b0, b2), _mm_slli_epi16(b1, 1)), _mm_add_epi16(_mm_add_epi16(a0, a2), _mm_slli_epi16(a1, 1)));
+        return _mm_add_epi16(_mm_max_epi16(gx, _mm_sub_epi16(zero, gx)), _mm_max_epi16(gy, _mm_sub_epi16(zero, gy)));
+    }
+
+    // 16 pixels per step.
+    void gradientRowSSE2(const uchar *a, const uchar *r, const uchar *b, uchar *edges, int32_t cols, int32_t threshold) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i limit = _mm_set1_epi16(static_cast<short>(min(threshold, 32767) - 1));
+        edges[0] = edges[cols - 1] = 0;
+        int32_t x = 1;
+        for (; x + 17 <= cols; x += 16) {
+            __m128i v[8][2];
+            const uchar *sources[8] = { a + x - 1, a + x, a + x + 1, r + x - 1, r + x + 1, b + x - 1, b + x, b + x + 1 };
+            for (int32_t i = 0; i < 8; i++) {
+                const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sources[i]));
+                v[i][0] = _mm_unpacklo_epi8(bytes, zero);
+                v[i][1] = _mm_unpackhi_epi8(bytes, zero);
+            }
+            __m128i mask[2];
+            for (int32_t h = 0; h < 2; h++) {
+                mask[h] = _mm_cmpgt_epi16(sobelMagnitudeSSE2(v[0][h], v[1][h], v[2][h], v[3][h], v[4][h], v[5][h], v[6][h], v[7][h]), limit);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(edges + x), _mm_packs_epi16(mask[0], mask[1]));
+        }
+        gradientRowTail(a, r, b, edges, x, cols, threshold);
+    }
+#endif
+
+#if defined(GRADIENT_AVX2_AT_RUNTIME)
+    // 16 pixels per step, widened to one 256 bit register. Compiled for AVX2 whatever the rest of the file is
+    // built for; availableGradientKernels only offers it on CPUs that have AVX2.
+    __attribute__((target("avx2")))
+    void gradientRowAVX2(const uchar *a, const uchar *r, const uchar *b, uchar *edges, int32_t cols, int32_t threshold) {
+        const __m256i limit = _mm256_set1_epi16(static_cast<short>(min(threshold, 32767) - 1));
+        edges[0] = edges[cols - 1] = 0;
+        int32_t x = 1;
+        for (; x + 17 <= cols; x += 16) {
+            const __m256i a0 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x - 1)));
+            const __m256i a1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x)));
+            const __m256i a2 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x + 1)));
+            const __m256i r0 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r + x - 1)));
+            const __m256i r2 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r + x + 1)));
+            const __m256i b0 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x - 1)));
+            const __m256i b1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x)));
+            const __m256i b2 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x + 1)));
+            const __m256i gx = _mm256_add_epi16(_mm256_add_epi16(_mm256_sub_epi16(a2, a0), _mm256_sub_epi16(b2, b0)), _mm256_slli_epi16(_mm256_sub_epi16(r2, r0), 1));
+            const __m256i gy = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(b0, b2), _mm256_slli_epi16(b1, 1)), _mm256_add_epi16(_mm256_add_epi16(a0, a2), _mm256_slli_epi16(a1, 1)));
+            const __m256i magnitude = _mm256_add_epi16(_mm256_abs_epi16(gx), _mm256_abs_epi16(gy));
+            const __m256i mask = _mm256_cmpgt_epi16(magnitude, limit);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(edges + x), _mm_packs_epi16(_mm256_castsi256_si128(mask), _mm256_extracti128_si256(mask, 1)));
+        }
+        gradientRowTail(a, r, b, edges, x, cols, threshold);
+    }
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    inline int16x8_t widenNEON(const uchar *p) {
+        return vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p)));
+    }
+
+    // 8 pixels per step.
+    void gradientRowNEON(const uchar *a, const uchar *r, const uchar *b, uchar *edges, int32_t cols, int32_t threshold) {
+        const int16x8_t limit = vdupq_n_s16(static_cast<int16_t>(min(threshold, 32767)));
+        edges[0] = edges[cols - 1] = 0;
+        int32_t x = 1;
+        for (; x + 9 <= cols; x += 8) {
+            const int16x8_t a0 = widenNEON(a + x - 1), a1 = widenNEON(a + x), a2 = widenNEON(a + x + 1);
+            const int16x8_t r0 = widenNEON(r + x - 1), r2 = widenNEON(r + x + 1);
+            const int16x8_t b0 = widenNEON(b + x - 1), b1 = widenNEON(b + x), b2 = widenNEON(b + x + 1);
+            const int16x8_t gx = vaddq_s16(vaddq_s16(vsubq_s16(a2, a0), vsubq_s16(b2, b0)), vshlq_n_s16(vsubq_s16(r2, r0), 1));
+            const int16x8_t gy = vsubq_s16(vaddq_s16(vaddq_s16(b0, b2), vshlq_n_s16(b1, 1)), vaddq_s16(vaddq_s16(a0, a2), vshlq_n_s16(a1, 1)));
+            const uint16x8_t mask = vcgeq_s16(vaddq_s16(vabsq_s16(gx), vabsq_s16(gy)), limit);
+            vst1_u8(edges + x, vmovn_u16(mask));
+        }
+        gradientRowTail(a, r, b, edges, x, cols, threshold);
+    }
+#endif
+
+    vector<GradientKernel> availableGradientKernels() {
+        vector<GradientKernel> kernels;
+        GradientKernel scalar = { "scalar", gradientRowScalar };
+        kernels.push_back(scalar);
+#if defined(__SSE2__)
+        GradientKernel sse2 = { "sse2", gradientRowSSE2 };
+        kernels.push_back(sse2);
+#endif
+#if defined(GRADIENT_AVX2_AT_RUNTIME)
+        __builtin_cpu_init(); // may run from a static constructor, before libgcc did it
+        if (__builtin_cpu_supports("avx2")) {
+            GradientKernel avx2 = { "avx2", gradientRowAVX2 };
+            kernels.push_back(avx2);
+        }
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+        GradientKernel neon = { "neon", gradientRowNEON };
+        kernels.push_back(neon);
+#endif
+        return kernels;
+    }
+
+    bool findGradientKernel(const string &name, GradientKernel &kernel) {
+        const vector<GradientKernel> kernels = availableGradientKernels();
+        for (uint32_t i = 0; i < kernels.size(); i++) {
+            if (name == kernels[i].name) {
+                kernel = kernels[i];
+                return true;
+            }
+        }
+        kernel = kernels.back();
+        return (name == "auto");
+    }
+
+    // Computes the edge map of bgr reduced by SCALE row by row: every luma row is produced right before the
+    // gradient needs it and only three of them exist at a time, so nothing but edges is written to memory.
+    template<int32_t SCALE>
+    void fusedEdges(const Mat &bgr, Mat &edges, Mat &lumaRows, int32_t threshold, GradientRowFunction gradientRow) {
+        const int32_t rows = edges.rows;
+        const int32_t cols = edges.cols;
+        if ( (rows < 3) || (cols < 3) ) {
+            edges.setTo(Scalar::all(0));
+            return;
+        }
+        uchar *luma[3] = { lumaRows.ptr<uchar>(0), lumaRows.ptr<uchar>(1), lumaRows.ptr<uchar>(2) };
+        grayRow<SCALE>(bgr, 0, luma[0], cols);
+        grayRow<SCALE>(bgr, 1, luma[1], cols);
+        memset(edges.ptr<uchar>(0), 0, cols);
+        for (int32_t y = 1; y < rows - 1; y++) {
+            grayRow<SCALE>(bgr, y + 1, luma[(y + 1) % 3], cols);
+            gradientRow(luma[(y - 1) % 3], luma[y % 3], luma[(y + 1) % 3], edges.ptr<uchar>(y), cols, threshold);
+        }
+        memset(edges.ptr<uchar>(rows - 1), 0, cols);
+    }
+
+    // Sets the pixels of the bright runs in a luma row to 255 in marks and all others to 0. A run is every
+    // pixel above the low threshold around at least one pixel above the high threshold (hysteresis).
+    void thresholdMarkings(const uchar *luma, uchar *marks, int32_t cols, int32_t minWidth, const MarkingThreshold &markingThreshold) {
+        uint32_t sum = 0;
+        int32_t maximum = 0;
+        for (int32_t x = 0; x < cols; x++) {
+            sum += luma[x];
+            maximum = max(maximum, static_cast<int32_t>(luma[x]));
+        }
+        memset(marks, 0, cols);
+        const int32_t mean = (cols > 0) ? static_cast<int32_t>(sum / cols) : 0;
+        if (maximum - mean < markingThreshold.minContrast) {
+            return;
+        }
+        const int32_t high = mean + cvRound(markingThreshold.high * (maximum - mean));
+        const int32_t low = mean + cvRound(markingThreshold.low * (maximum - mean));
+
+        int32_t x = 0;
+        while (x < cols) {
+            if (luma[x] < low) {
+                x++;
+                continue;
+            }
+            int32_t end = x;
+            bool strong = false;
+            while ( (end < cols) && (luma[end] >= low) ) {
+                strong = strong || (luma[end] >= high);
+                end++;
+            }
+            if (strong && (end - x >= minWidth)) {
+                memset(marks + x, 255, end - x);
+            }
+            x = end;
+        }
+    }
+
+    // Fills the rows of the edge map that hold a scanline with the bright runs of the matching rows of bgr;
+    // all other rows stay empty. edgeView.pixels is the edge map, bgr the band it was reduced from.
+    template<int32_t SCALE>
+    void markScanlineRows(const Mat &bgr, const FrameView &edgeView, uchar *luma, const ScanlineGeometry &scanlines, const MarkingThreshold &markingThreshold) {
+        Mat edges = edgeView.pixels;
+        edges.setTo(Scalar::all(0));
+        const int32_t minWidth = max(1, markingThreshold.minWidth / SCALE);
+        for (int32_t i = 0; i < scanlines.numberOfScanlines; i++) {
+            const int32_t row = toViewPixels(edgeView, Point(0, scanlines.firstRow + i * scanlines.spacing)).y;
+            if ( (row >= 0) && (row < edges.rows) ) {
+                grayRow<SCALE>(bgr, row, luma, edges.cols);
+                thresholdMarkings(luma, edges.ptr<uchar>(row), edges.cols, minWidth, markingThreshold);
+            }
+        }
+    }
+
+    // The synthetic band has a dark floor and bright markings.
+    void benchmarkEdgeDetectors(const LaneFeatureExtractorConfiguration &configuration, int32_t iterations) {
+        const int32_t rows = 81;
+        const int32_t cols = 640;
+        Mat bgr(rows, cols, CV_8UC3);
+        randu(bgr, Scalar::all(0), Scalar::all(60));
+        const int32_t markings[] = { 90, 300, 520 };
+        for (uint32_t i = 0; i < sizeof(markings) / sizeof(markings[0]); i++) {
+            bgr.colRange(markings[i], markings[i] + 12).setTo(Scalar::all(230));
+        }
+
+        Mat gray;
+        Mat canny;
+        int64_t start = getTickCount();
+        for (int32_t i = 0; i < iterations; i++) {
+            cvtColor(bgr, gray, CV_BGR2GRAY);
+            Canny(gray, canny, configuration.cannyLowThreshold, configuration.cannyHighThreshold, configuration.cannyAperture);
+        }
+        const double cannyTime = (getTickCount() - start) / getTickFrequency();
+        cerr << "Edges, cvtColor + Canny: " << (cannyTime * 1e6 / iterations) << " us, "
+             << countNonZero(canny) << " edge pixels" << endl;
+
+        Mat lumaRows(3, cols, CV_8UC1);
+        Mat reference(rows, cols, CV_8UC1);
+        fusedEdges<1>(bgr, reference, lumaRows, configuration.edgeThreshold, gradientRowScalar);
+        const vector<GradientKernel> kernels = availableGradientKernels();
+        for (uint32_t k = 0; k < kernels.size(); k++) {
+            Mat edges(rows, cols, CV_8UC1);
+            start = getTickCount();
+            for (int32_t i = 0; i < iterations; i++) {
+                fusedEdges<1>(bgr, edges, lumaRows, configuration.edgeThreshold, kernels[k].function);
+            }
+            const double fusedTime = (getTickCount() - start) / getTickFrequency();
+            cerr << "Edges, fused " << kernels[k].name << ": " << (fusedTime * 1e6 / iterations) << " us, "
+                 << countNonZero(edges) << " edge pixels"
+                 << (countNonZero(edges != reference) == 0 ? "" : " (RESULTS DIFFER)") << endl;
+        }
+    }
+
+    // Moves a found hit to the strongest horizontal luma step within radius columns of it in the
+    // full resolution BGR band; this recovers the precision a reduced resolution search gives up.
+    void refineHit(const FrameView &band, int32_t y, int32_t radius, EdgeHit &hit) {
+        const Point p = toViewPixels(band, Point(hit.x, y));
+        const int32_t cols = band.pixels.cols;
+        if (!hit.found || p.y < 0 || p.y >= band.pixels.rows) {
+            return;
+        }
+        const uchar *row = band.pixels.ptr<uchar>(p.y);
+        int32_t best = -1;
+        int32_t bestStep = -1;
+        for (int32_t c = max(1, p.x - radius); c <= min(cols - 2, p.x + radius); c++) {
+            const int32_t step = abs(static_cast<int32_t>(lumaOf(row + 3 * (c + 1))) - static_cast<int32_t>(lumaOf(row + 3 * (c - 1))));
+            if (step > bestStep) {
+                best = c;
+                bestStep = step;
+            }
+        }
+        if (best >= 0) {
+            hit.x = fromViewPixels(band, Point(best, p.y)).x;
+        }
+    }
+
+    // Searches all scanlines of a frame; used with parallel_for_ when there are many of them.
+    class ScanlineSearch : public ParallelLoopBody {
+        public:
+            // refinement is the full resolution BGR band for refineHit, or NULL to keep the hits as found.
+            // The range indexes scanlines, the list of scanlines to search.
+            ScanlineSearch(const FrameView &view, const FrameView *refinement, const TrackingParameters &tracking, vector<LaneTrack> &leftTracks, vector<LaneTrack> &rightTracks,
+                           const vector<int32_t> &scanlines, const vector<Point> &start, vector<Point> &leftEnd, vector<Point> &rightEnd) :
+                m_view(view),
+                m_refinement(refinement),
+                m_tracking(tracking),
+                m_leftTracks(leftTracks),
+                m_rightTracks(rightTracks),
+                m_scanlines(scanlines),
+                m_start(start),
+                m_leftEnd(leftEnd),
+                m_rightEnd(rightEnd) {}
+
+            virtual void operator()(const Range &range) const {
+                for (int32_t r = range.start; r < range.end; r++) {
+                    const int32_t i = m_scanlines[r];
+                    EdgeHit right;
+                    EdgeHit left;
+                    if (m_tracking.enabled) {
+                        right = findTrackedEdge(m_view, m_start[i], true, m_rightTracks[i], m_tracking);
+                        left = findTrackedEdge(m_view, m_start[i], false, m_leftTracks[i], m_tracking);
+                    }
+                    else {
+                        right = findEdge(m_view, m_start[i], true);
+                        left = findEdge(m_view, m_start[i], false);
+                    }
+                    if (m_refinement != NULL) {
+                        refineHit(*m_refinement, m_start[i].y, m_view.scale, right);
+                        refineHit(*m_refinement, m_start[i].y, m_view.scale, left);
+                    }
+                    if (m_tracking.enabled) {
+                        // Every scanline owns its tracks, so this is safe within parallel_for_.
+                        m_rightEnd[i] = Point(updateTrack(m_rightTracks[i], right, m_tracking), m_start[i].y);
+                        m_leftEnd[i] = Point(updateTrack(m_leftTracks[i], left, m_tracking), m_start[i].y);
+                    }
+                    else {
+                        m_rightEnd[i] = Point(right.x, m_start[i].y);
+                        m_leftEnd[i] = Point(left.x, m_start[i].y);
+                    }
+                }
+            }
+
+        private:
+            const FrameView &m_view;
+            const FrameView *m_refinement;
+            const TrackingParameters &m_tracking;
+            vector<LaneTrack> &m_leftTracks;
+            vector<LaneTrack> &m_rightTracks;
+            const vector<int32_t> &m_scanlines;
+            const vector<Point> &m_start;
+            vector<Point> &m_leftEnd;
+            vector<Point> &m_rightEnd;
+    };
+
+    // Looks for a stop line or the crossing lane of an intersection in the edge band: rows of the lane in front
+    // of the car that are mostly edge pixels (the boundaries of a horizontal marking), met first by vertical probes
+    // walking up from the car. Returns the share of probes that meet such a row; isRun is scratch space.
+    double findIntersection(const FrameView &edges, int32_t startColumn, const IntersectionParameters &parameters, vector<uchar> &isRun) {
+        const Mat &pixels = edges.pixels;
+        // The lane in storage columns; a mirrored view stores it reversed.
+        const int32_t a = toViewPixels(edges, Point(startColumn - parameters.halfWidth, edges.firstRow)).x;
+        const int32_t b = toViewPixels(edges, Point(startColumn + parameters.halfWidth, edges.firstRow)).x;
+        const int32_t begin = max(0, min(a, b));
+        const int32_t end = min(pixels.cols, max(a, b) + 1);
+        if ( (pixels.rows == 0) || (parameters.probes <= 0) || (end - begin < parameters.probes) ) {
+            return 0;
+        }
+
+        // The rows are in cache from the scan; counting them is one vector pass each.
+        const int32_t minimum = max(1, cvRound(parameters.minFill * (end - begin)));
+        isRun.resize(pixels.rows);
+        for (int32_t r = 0; r < pixels.rows; r++) {
+            isRun[r] = (countEdgePixels(pixels.ptr<uchar>(r), begin, end) >= minimum) ? 1 : 0;
+        }
+
+        int32_t agreeing = 0;
+        for (int32_t p = 0; p < parameters.probes; p++) {
+            const int32_t column = begin + (2 * p + 1) * (end - begin) / (2 * parameters.probes);
+            // Up in the frame is down in the storage of a mirrored view.
+            for (int32_t k = 0; k < pixels.rows; k++) {
+                const int32_t r = edges.mirrored ? k : pixels.rows - 1 - k;
+                if (pixels.ptr<uchar>(r)[column] != 0) {
+                    agreeing += isRun[r];
+                    break;
+                }
+            }
+        }
+        return static_cast<double>(agreeing) / parameters.probes;
+    }
+
+    void benchmarkEdgeSearch(int32_t iterations) {
+        const int32_t cols = 640;
+        const int32_t distances[] = { 4, 16, 64, 160, 319 };
+        const int32_t numberOfDistances = sizeof(distances) / sizeof(distances[0]);
+        vector<uchar> row(cols, 0);
+
+        for (int32_t d = 0; d < numberOfDistances; d++) {
+            const int32_t x = cols / 2;
+            fill(row.begin(), row.end(), 0);
+            row[x + distances[d]] = 255;
+            row[x - distances[d]] = 255;
+
+            int64_t checksumScalar = 0;
+            int64_t checksumVector = 0;
+            int64_t start = getTickCount();
+            for (int32_t i = 0; i < iterations; i++) {
+                checksumScalar += findEdgeRightScalar(&row[0], cols, x).x + findEdgeLeftScalar(&row[0], cols, x).x;
+            }
+            const double scalarTime = (getTickCount() - start) / getTickFrequency();
+
+            start = getTickCount();
+            for (int32_t i = 0; i < iterations; i++) {
+                checksumVector += findEdgeRight(&row[0], cols, x).x + findEdgeLeft(&row[0], cols, x).x;
+            }
+            const double vectorTime = (getTickCount() - start) / getTickFrequency();
+
+            cerr << "Edge search, distance " << distances[d] << " px: scalar " << (scalarTime * 1e9 / iterations)
+                 << " ns, vectorized " << (vectorTime * 1e9 / iterations) << " ns"
+                 << (checksumScalar == checksumVector ? "" : " (RESULTS DIFFER)") << endl;
+        }
+    }
+
+
+    LaneFeatureExtractor::LaneFeatureExtractor() :
+        m_configuration(),
+        m_workspace(),
+        m_band(),
+        m_edges(),
+        m_leftTracks(),
+        m_rightTracks(),
+        m_allScanlines(),
+        m_steeringScanlines(),
+        m_horizontalRuns(),
+        m_perspective(NULL),
+        m_boundEdges(),
+        m_perspectiveBound(false),
+        m_perspectiveOffsets(),
+        m_allStripRows(),
+        m_reducedStripRows(),
+        m_birdsEye(),
+        m_shedding(false),
+        m_steering(0),
+        m_speed(0) {
+        configure(m_configuration);
+    }
+
+    LaneFeatureExtractor::LaneFeatureExtractor(const LaneFeatureExtractorConfiguration &configuration) :
+        m_configuration(),
+        m_workspace(),
+        m_band(),
+        m_edges(),
+        m_leftTracks(),
+        m_rightTracks(),
+        m_allScanlines(),
+        m_steeringScanlines(),
+        m_horizontalRuns(),
+        m_perspective(NULL),
+        m_boundEdges(),
+        m_perspectiveBound(false),
+        m_perspectiveOffsets(),
+        m_allStripRows(),
+        m_reducedStripRows(),
+        m_birdsEye(),
+        m_shedding(false),
+        m_steering(0),
+        m_speed(0) {
+        configure(configuration);
+    }
+
+    void LaneFeatureExtractor::configure(const LaneFeatureExtractorConfiguration &configuration) {
+        m_configuration = configuration;
+        m_configuration.scanlines.numberOfScanlines = max(1, m_configuration.scanlines.numberOfScanlines);
+        m_configuration.scanlines.leftThresholds.resize(m_configuration.scanlines.numberOfScanlines, -1);
+
+        resetTracks();
+        m_allScanlines.clear();
+        m_steeringScanlines.clear();
+        for (int32_t i = 0; i < m_configuration.scanlines.numberOfScanlines; i++) {
+            m_allScanlines.push_back(i);
+            if ( (i == 0) || (m_configuration.scanlines.leftThresholds[i] >= 0) ) {
+                m_steeringScanlines.push_back(i);
+            }
+        }
+        m_steering = 0;
+        m_speed = 0;
+    }
+
+    // One track per scanline of the scan that runs: strip rows once the perspective map is bound, frame rows otherwise.
+    void LaneFeatureExtractor::resetTracks() {
+        LaneTrack noTrack;
+        noTrack.position = 0;
+        noTrack.velocity = 0;
+        noTrack.misses = 0;
+        noTrack.valid = false;
+        const int32_t numberOfTracks = ( (m_perspective != NULL) && m_perspectiveBound ) ? m_perspective->getRows() : m_configuration.scanlines.numberOfScanlines;
+        m_leftTracks.assign(numberOfTracks, noTrack);
+        m_rightTracks.assign(numberOfTracks, noTrack);
+    }
+
+    const LaneFeatureExtractorConfiguration& LaneFeatureExtractor::getConfiguration() const {
+        return m_configuration;
+    }
+
+    void LaneFeatureExtractor::setShedding(bool shedding) {
+        m_shedding = shedding;
+    }
+
+    bool LaneFeatureExtractor::isShedding() const {
+        return m_shedding;
+    }
+
+    void LaneFeatureExtractor::setPerspective(const InversePerspectiveMap *perspective) {
+        m_perspective = ( (perspective != NULL) && perspective->isCompiled() ) ? perspective : NULL;
+        m_perspectiveBound = false;
+        m_perspectiveOffsets.clear();
+        m_allStripRows.clear();
+        m_reducedStripRows.clear();
+        for (int32_t i = 0; (m_perspective != NULL) && (i < m_perspective->getRows()); i++) {
+            m_allStripRows.push_back(i);
+            if (i % 2 == 1) {
+                m_reducedStripRows.push_back(i);
+            }
+        }
+        if (m_reducedStripRows.empty()) {
+            m_reducedStripRows = m_allStripRows;
+        }
+        m_birdsEye = Mat();
+        resetTracks();
+        m_steering = 0;
+        m_speed = 0;
+    }
+
+    bool LaneFeatureExtractor::isPerspectiveBound() const {
+        return (m_perspective != NULL) && m_perspectiveBound;
+    }
+
+    const Mat& LaneFeatureExtractor::getBirdsEye() const {
+        return m_birdsEye;
+    }
+
+    // Rebinds the remap table when the storage of the edge map changed, which only happens when the camera
+    // resolution or the configuration does. Returns false if the map does not fit the frame.
+    bool LaneFeatureExtractor::bindPerspective() {
+        const FrameView &e = m_edges;
+        const FrameView &b = m_boundEdges;
+        if ( m_perspectiveOffsets.empty() || (e.firstRow != b.firstRow) || (e.mirrored != b.mirrored) || (e.scale != b.scale) ||
+             (e.pixels.rows != b.pixels.rows) || (e.pixels.cols != b.pixels.cols) || (e.pixels.step != b.pixels.step) ) {
+            const bool wasBound = m_perspectiveBound;
+            m_boundEdges = m_edges;
+            m_perspectiveBound = m_perspective->bind(m_edges, m_perspectiveOffsets);
+            if (m_perspectiveBound != wasBound) {
+                // Strip rows and frame scanlines differ in number and meaning.
+                resetTracks();
+            }
+        }
+        return m_perspectiveBound;
+    }
+
+    // Rows Canny needs above and below the scanned band: the Sobel radius plus one row for the non-maximum suppression,
+    // counted in rows of the reduced resolution edge map. EDGES_THRESHOLD only looks at the scanline rows themselves,
+    // but needs enough rows around them that trimming the band to whole blocks never loses one.
+    int32_t LaneFeatureExtractor::getEdgeMargin() const {
+        const LaneFeatureExtractorConfiguration &c = m_configuration;
+        return (c.edgeDetector == EDGES_THRESHOLD) ? c.downscale - 1 : (c.cannyAperture / 2 + 1) * c.downscale;
+    }
+
+    const FrameView& LaneFeatureExtractor::getEdges() const {
+        return m_edges;
+    }
+
+    FrameWorkspace& LaneFeatureExtractor::getWorkspace() {
+        return m_workspace;
+    }
+
+    void LaneFeatureExtractor::extract(const FrameView &frame, LaneFeatures &features) {
+        detectEdges(frame, features);
+        findFeatures(features);
+    }
+
+    void LaneFeatureExtractor::detectEdges(const FrameView &frame, LaneFeatures &features) {
+        const LaneFeatureExtractorConfiguration &c = m_configuration;
+
+        //http://docs.opencv.org/doc/user_guide/ug_mat.html   Handeling images
+        // Only the scanned rows plus the margin Canny needs around them are processed.
+        FrameView edgeView = cropView(frame, c.roiTop - getEdgeMargin(), c.roiBottom + getEdgeMargin());
+        // Blocks must tile the frame width for the mirrored column mapping; otherwise stay at full resolution.
+        const int32_t scale = (edgeView.pixels.cols % c.downscale == 0) ? c.downscale : 1;
+        // Full resolution pixels for refineHit.
+        m_band = edgeView;
+        if (scale > 1) {
+            // Only whole blocks are used; the rows left over are the last ones of the storage.
+            const int32_t rows = (edgeView.pixels.rows / scale) * scale;
+            if (edgeView.mirrored) {
+                edgeView.firstRow += edgeView.pixels.rows - rows;
+            }
+            edgeView.pixels = edgeView.pixels.rowRange(0, rows);
+            edgeView.scale = scale;
+        }
+        m_workspace.prepareEdges(edgeView.pixels.rows / scale, edgeView.pixels.cols / scale);
+        Mat &gray = m_workspace.gray; // for converting to gray
+
+        int64_t stageStart = monotonicMicroseconds();
+        Mat &canny = m_workspace.edges; //Canny for detecting edges ,http://docs.opencv.org/doc/tutorials/imgproc/imgtrans/canny_detector/canny_detector.html
+        features.grayMicroseconds = -1;
+        if (c.edgeDetector == EDGES_FUSED) {
+            // Gray and edges in one pass.
+            if (scale == 4) {
+                fusedEdges<4>(edgeView.pixels, canny, m_workspace.lumaRows, c.edgeThreshold, c.gradientKernel.function);
+            }
+            else if (scale == 2) {
+                fusedEdges<2>(edgeView.pixels, canny, m_workspace.lumaRows, c.edgeThreshold, c.gradientKernel.function);
+            }
+            else {
+                fusedEdges<1>(edgeView.pixels, canny, m_workspace.lumaRows, c.edgeThreshold, c.gradientKernel.function);
+            }
+        }
+        else if (c.edgeDetector == EDGES_THRESHOLD) {
+            // Only the scanline rows are converted and thresholded.
+            const Mat bgr = edgeView.pixels;
+            edgeView.pixels = canny;
+            if (scale == 4) {
+                markScanlineRows<4>(bgr, edgeView, m_workspace.lumaRows.ptr<uchar>(0), c.scanlines, c.markingThreshold);
+            }
+            else if (scale == 2) {
+                markScanlineRows<2>(bgr, edgeView, m_workspace.lumaRows.ptr<uchar>(0), c.scanlines, c.markingThreshold);
+            }
+            else {
+                markScanlineRows<1>(bgr, edgeView, m_workspace.lumaRows.ptr<uchar>(0), c.scanlines, c.markingThreshold);
+            }
+        }
+        else {
+            if (scale == 4) {
+                downscaleToGray<4>(edgeView.pixels, gray);
+            }
+            else if (scale == 2) {
+                downscaleToGray<2>(edgeView.pixels, gray);
+            }
+            else {
+                cvtColor(edgeView.pixels, gray, CV_BGR2GRAY); //Let's make the image gray 
+            }
+            const int64_t stageEnd = monotonicMicroseconds();
+            features.grayMicroseconds = stageEnd - stageStart;
+            stageStart = stageEnd;
+            Canny(gray, canny, c.cannyLowThreshold, c.cannyHighThreshold, c.cannyAperture); //inputing Canny limits 
+        }
+        edgeView.pixels = canny; // the scan reads the single channel edge map directly
+        m_workspace.finishFrame();
+        features.edgesMicroseconds = monotonicMicroseconds() - stageStart;
+        features.acquired = frame.acquired;
+        features.captured = frame.captured;
+        m_edges = edgeView;
+    }
+
+    void LaneFeatureExtractor::findFeatures(LaneFeatures &features) {
+        const LaneFeatureExtractorConfiguration &c = m_configuration;
+        const int64_t stageStart = monotonicMicroseconds();
+        if ( (m_perspective != NULL) && bindPerspective() ) {
+            findBirdsEyeFeatures(features);
+            findStopLine(features);
+            features.scanMicroseconds = monotonicMicroseconds() - stageStart;
+            return;
+        }
+
+        // get matrix size  http://docs.opencv.org/modules/core/doc/basic_structures.html
+        int cols = m_edges.pixels.cols * m_edges.scale; // in frame pixels
+        //int rows = matImg.rows;
+
+        const int32_t numberOfScanlines = c.scanlines.numberOfScanlines;
+        features.start.resize(numberOfScanlines);
+        features.leftEnd.resize(numberOfScanlines);
+        features.rightEnd.resize(numberOfScanlines);
+        vector<Point> &myPointStart = features.start; // array of startpoints
+        vector<Point> &myPointRightEnd = features.rightEnd; // array of rightEnd Point
+        vector<Point> &myPointLeftEnd = features.leftEnd; // array of LeftEnd Point
+        for(int i=0; i<numberOfScanlines;i++)
+        {
+            myPointStart[i].x=(c.scanlines.startColumn < 0 ? cols/2 : c.scanlines.startColumn);  // middle of the img
+            myPointStart[i].y=c.scanlines.firstRow + i*c.scanlines.spacing; // Each point has a new Y-point
+        }
+        const bool refine = c.refineHits && (m_edges.scale > 1) && !m_shedding;
+        const vector<int32_t> &scanlines = (m_shedding ? m_steeringScanlines : m_allScanlines);
+        const int32_t numberOfSearchedScanlines = scanlines.size();
+        if (m_shedding) {
+            // The skipped scanlines end where they start and keep their tracks for later.
+            for(int i=0; i<numberOfScanlines;i++)
+            {
+                myPointLeftEnd[i] = myPointStart[i];
+                myPointRightEnd[i] = myPointStart[i];
+            }
+        }
+        ScanlineSearch search(m_edges, (refine ? &m_band : NULL), c.tracking, m_leftTracks, m_rightTracks, scanlines, myPointStart, myPointLeftEnd, myPointRightEnd);
+        if (numberOfSearchedScanlines >= c.scanlines.parallelThreshold) {
+            parallel_for_(Range(0, numberOfSearchedScanlines), search);
+        }
+        else {
+            search(Range(0, numberOfSearchedScanlines));
+        }
+
+        // Share of searched scanline ends that hit a lane marking.
+        uint32_t hits = 0;
+        for(int r=0; r<numberOfSearchedScanlines;r++)
+        {
+            const int i = scanlines[r];
+            hits += (myPointLeftEnd[i].x >= 0 ? 1 : 0) + (myPointRightEnd[i].x < cols ? 1 : 0);
+        }
+        features.confidence = static_cast<double>(hits) / (2 * numberOfSearchedScanlines);
+
+        steer(features);
+        findStopLine(features);
+        features.scanMicroseconds = monotonicMicroseconds() - stageStart;
+    }
+
+    void LaneFeatureExtractor::findStopLine(LaneFeatures &features) {
+        const IntersectionParameters &parameters = m_configuration.intersection;
+        features.intersectionConfidence = 0;
+        if (parameters.enabled) {
+            features.intersectionConfidence = findIntersection(m_edges, features.start[0].x, parameters, m_horizontalRuns);
+            features.intersection = features.intersection || (features.intersectionConfidence >= parameters.threshold);
+        }
+    }
+
+    // Warps the edge band into the bird's-eye strip, searches its rows like scanlines and steers in metres.
+    // The ends are handed out in frame coordinates like those of the frame row scan.
+    void LaneFeatureExtractor::findBirdsEyeFeatures(LaneFeatures &features) {
+        const InversePerspectiveMap &perspective = *m_perspective;
+        perspective.warp(m_edges.pixels, m_perspectiveOffsets, m_birdsEye);
+
+        FrameView strip;
+        strip.pixels = m_birdsEye;
+        strip.firstRow = 0;
+        strip.mirrored = false;
+        strip.scale = 1;
+        strip.acquired = m_edges.acquired;
+        strip.captured = m_edges.captured;
+
+        const int32_t rows = perspective.getRows();
+        features.start.resize(rows);
+        features.leftEnd.resize(rows);
+        features.rightEnd.resize(rows);
+        for (int32_t i = 0; i < rows; i++) {
+            features.start[i] = Point(perspective.getCentreColumn(), i);
+            // Rows skipped while shedding end where they start.
+            features.leftEnd[i] = features.start[i];
+            features.rightEnd[i] = features.start[i];
+        }
+        const vector<int32_t> &scanlines = (m_shedding ? m_reducedStripRows : m_allStripRows);
+        const int32_t numberOfSearchedScanlines = scanlines.size();
+        ScanlineSearch search(strip, NULL, m_configuration.tracking, m_leftTracks, m_rightTracks, scanlines, features.start, features.leftEnd, features.rightEnd);
+        search(Range(0, numberOfSearchedScanlines));
+
+        uint32_t hits = 0;
+        for (int32_t r = 0; r < numberOfSearchedScanlines; r++) {
+            const int32_t i = scanlines[r];
+            hits += (features.leftEnd[i].x >= 0 ? 1 : 0) + (features.rightEnd[i].x < strip.pixels.cols ? 1 : 0);
+        }
+        features.confidence = static_cast<double>(hits) / (2 * numberOfSearchedScanlines);
+        steerMetric(features, scanlines);
+
+        const int32_t frameWidth = m_edges.pixels.cols * m_edges.scale;
+        for (int32_t i = 0; i < rows; i++) {
+            const Point start = perspective.toFrame(features.start[i]);
+            features.leftEnd[i] = (features.leftEnd[i].x < 0) ? Point(-1, start.y) : perspective.toFrame(features.leftEnd[i]);
+            features.rightEnd[i] = (features.rightEnd[i].x >= strip.pixels.cols) ? Point(frameWidth, start.y) : perspective.toFrame(features.rightEnd[i]);
+            features.start[i] = start;
+        }
+    }
+
+/*-----------Emily--------------*/
+    void LaneFeatureExtractor::steer(LaneFeatures &features) {
+        const ScanlineGeometry &scanlines = m_configuration.scanlines;
+        const vector<Point> &myPointRightEnd = features.rightEnd;
+        const vector<Point> &myPointLeftEnd = features.leftEnd;
+
+		//Right
+		//[3]494
+		//[2]471
+		//[1]448
+		//[0]425
+
+		//Left (lanedetector.scanlines.leftThresholds)
+		//[3] 145
+		//[2] 168
+		//[1] 191
+		//[0] 214
+
+	double steeringAngle;
+	int desiredDistRight = scanlines.desiredDistRight; //desired dist to the side lane
+	//int desiredDistLeft = 180;//(145 + 168 + 191 + 214)/4
+	int difference;
+
+	bool intersection = false;
+	bool leftLost = false;
+	for(int i=0; i<scanlines.numberOfScanlines;i++)
+	{
+		leftLost = leftLost || (myPointLeftEnd[i].x < scanlines.leftThresholds[i]);
+	}
+		
+//(actual distance - dotted line) - desiredright = difference that needs to be adjusted. when in staight road, this should be 0
+if (myPointRightEnd[0].x > scanlines.rightLostColumn) //is Rn lost?
+{
+	if (leftLost) // is left lost?
+	{
+		intersection = true;
+		m_steering = 0;
+	 	m_speed = 2; // intersection
+	}
+		//else{
+		//	cout << "intersection" << endl; 
+		//	spd.setSpeedData(0);
+		//	sd.setExampleData(90);
+		//}
+
+}
+else // no, follow right
+{
+	difference = (myPointRightEnd[0].x - scanlines.laneOffset) - desiredDistRight; //use bottom line in case top lines disappear while turning or in intersection
+	steeringAngle = difference * 0.1;
+	m_steering = steeringAngle;
+	m_speed = 2;
+}
+
+        features.steering = m_steering;
+        features.speed = m_speed;
+        features.intersection = intersection;
+    }
+
+    // The rule of steer in metres on the bird's-eye strip: follow the right line at the mean of its hits,
+    // which looks ahead over all rows, and call it an intersection when both lines are gone.
+    void LaneFeatureExtractor::steerMetric(LaneFeatures &features, const vector<int32_t> &scanlines) {
+        const MetricSteering &metric = m_configuration.metricSteering;
+        double right = 0;
+        int32_t rightHits = 0;
+        int32_t leftHits = 0;
+        for (uint32_t r = 0; r < scanlines.size(); r++) {
+            const int32_t i = scanlines[r];
+            if (features.rightEnd[i].x < m_perspective->getColumns()) {
+                right += m_perspective->getLateral(features.rightEnd[i].x);
+                rightHits++;
+            }
+            leftHits += (features.leftEnd[i].x >= 0) ? 1 : 0;
+        }
+
+        bool intersection = false;
+        if (rightHits == 0) {
+            // As in steer: keep the last command while only the right line is lost.
+            if (2 * leftHits < static_cast<int32_t>(scanlines.size())) {
+                intersection = true;
+                m_steering = 0;
+                m_speed = 2;
+            }
+        }
+        else {
+            m_steering = (right / rightHits - metric.desiredRight) * metric.gain;
+            m_speed = 2;
+        }
+        features.steering = m_steering;
+        features.speed = m_speed;
+        features.intersection = intersection;
+    }
+
+} // msv
@@ -0,0 +1,424 @@
+/**
+ * LaneFeatureExtractor.h - Lane marking features and lane following commands from camera frames.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef LANEFEATUREEXTRACTOR_H_
+#define LANEFEATUREEXTRACTOR_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+namespace msv {
+
+    using namespace std;
+
+    // Rows of the (mirrored) camera frame the lane scan works on.
+    struct FrameView {
+        cv::Mat pixels;   // Rows [firstRow, firstRow + pixels.rows) of the frame (BGR image or edge map).
+        int32_t firstRow; // First frame row held in pixels.
+        bool mirrored;    // pixels are stored as delivered by the camera, i.e. rotated by 180 degrees.
+        int32_t scale;    // Frame pixels per stored pixel in each direction; 1 at full resolution.
+        int64_t acquired; // monotonicMicroseconds() when the frame was taken from the shared memory.
+        int64_t captured; // Sent time stamp of the SHARED_IMAGE container in microseconds.
+    };
+
+    // Returns the part of view covering the frame rows [top, bottom], clamped to what view holds.
+    FrameView cropView(const FrameView &view, int32_t top, int32_t bottom);
+
+    // Maps a point given in frame coordinates to the storage of view.pixels.
+    cv::Point toViewPixels(const FrameView &view, const cv::Point &p);
+
+    // Maps a point in the storage of view.pixels back to frame coordinates (the first frame pixel of its block).
+    cv::Point fromViewPixels(const FrameView &view, const cv::Point &p);
+
+    // How the edge map the scanlines search is computed.
+    enum EdgeDetector {
+        EDGES_CANNY = 0,     // cvtColor to gray, then Canny (original behaviour).
+        EDGES_FUSED = 1,     // One pass from BGR over luma and Sobel gradient to thresholded edges.
+        EDGES_THRESHOLD = 2, // Bright runs on the scanline rows only; no gradient at all.
+        NUMBER_OF_EDGE_DETECTORS
+    };
+
+    const char* getEdgeDetectorName(EdgeDetector detector);
+
+    // Sets detector to the one called name; returns false and leaves detector alone for unknown names.
+    bool parseEdgeDetector(const string &name, EdgeDetector &detector);
+
+    // Thresholds the L1 magnitude of the 3x3 Sobel gradient of the luma row between above and below
+    // into edges (255 or 0); the first and the last column have no neighbours and are always 0.
+    typedef void (*GradientRowFunction)(const uchar *above, const uchar *row, const uchar *below, uchar *edges, int32_t cols, int32_t threshold);
+
+    struct GradientKernel {
+        const char *name;
+        GradientRowFunction function;
+    };
+
+    // Variants this binary was built with and the processor supports, slowest first.
+    vector<GradientKernel> availableGradientKernels();
+
+    // Sets kernel to the variant called name; "auto" and unknown names (which return false) select the fastest one.
+    bool findGradientKernel(const string &name, GradientKernel &kernel);
+
+    // Adaptive threshold of EDGES_THRESHOLD, derived per scanline row from its mean and maximum luma.
+    struct MarkingThreshold {
+        double high;         // Fraction of the way from mean to maximum that some pixel of a marking reaches.
+        double low;          // Fraction of the way from mean to maximum that every pixel of a marking reaches.
+        int32_t minContrast; // Rows whose maximum is less than this above their mean have no marking.
+        int32_t minWidth;    // Narrower bright runs (in frame pixels) are noise or glare spots.
+    };
+
+    // Where the scanlines are placed and how their end points are turned into steering.
+    struct ScanlineGeometry {
+        int32_t numberOfScanlines;
+        int32_t firstRow;        // Frame row of scanline 0.
+        int32_t spacing;         // Rows between two neighbouring scanlines.
+        int32_t startColumn;     // Column every scan starts from; -1 means the image centre.
+        vector<int32_t> leftThresholds; // Left end below this means the left line is lost; -1 leaves a scanline out.
+        int32_t rightLostColumn; // Right end of scanline 0 beyond this means the right line is lost.
+        int32_t laneOffset;      // Subtracted from the right end of scanline 0 before comparing with desiredDistRight.
+        int32_t desiredDistRight;
+        int32_t parallelThreshold; // Evaluate scanlines with parallel_for_ from this many on.
+    };
+
+    // Settings for following the lane markings from one frame to the next.
+    struct TrackingParameters {
+        bool enabled;
+        int32_t window;    // Half width in pixels of the search window around the predicted column.
+        double alpha;      // Position gain of the alpha-beta filter; 1 means no smoothing.
+        double beta;       // Velocity gain of the alpha-beta filter.
+        int32_t maxMisses; // Frames without a hit before a track is dropped.
+    };
+
+    // Settings for finding a stop line or the crossing lane of an intersection in the edge band.
+    struct IntersectionParameters {
+        bool enabled;
+        int32_t probes;    // Vertical probe columns spread over the lane in front of the car.
+        int32_t halfWidth; // Frame columns on either side of the scanline start that make up the lane.
+        double minFill;    // Share of edge pixels a row of the lane needs to count as a horizontal run.
+        double threshold;  // Confidence from which a frame is flagged as an intersection.
+    };
+
+    // Steering from the bird's-eye strip, in metres instead of frame columns.
+    struct MetricSteering {
+        double desiredRight; // Metres the right line should be right of the camera.
+        double gain;         // Degrees of steering per metre the right line is off.
+    };
+
+    // Alpha-beta filtered column of one lane marking on one scanline.
+    struct LaneTrack {
+        double position;
+        double velocity; // Columns per frame.
+        int32_t misses;
+        bool valid;
+    };
+
+    /**
+     * Everything a LaneFeatureExtractor can be configured with. The
+     * defaults are the values the steering rule was tuned for.
+     */
+    struct LaneFeatureExtractorConfiguration {
+        LaneFeatureExtractorConfiguration();
+
+        ScanlineGeometry scanlines;
+        TrackingParameters tracking;
+        int32_t roiTop;    // First frame row needed by the scan.
+        int32_t roiBottom; // Last frame row needed by the scan.
+        EdgeDetector edgeDetector;
+        double cannyLowThreshold;
+        double cannyHighThreshold;
+        int32_t cannyAperture;
+        int32_t downscale;       // Edges are found on blocks of downscale x downscale pixels (1, 2 or 4).
+        bool refineHits;         // Move reduced resolution hits to the strongest full resolution step nearby.
+        int32_t edgeThreshold;   // L1 gradient magnitude an EDGES_FUSED edge pixel needs.
+        GradientKernel gradientKernel;
+        MarkingThreshold markingThreshold;
+        IntersectionParameters intersection;
+        MetricSteering metricSteering;
+    };
+
+    /**
+     * What the extractor found in one frame and the command it derived.
+     * The vectors are reused from frame to frame.
+     */
+    struct LaneFeatures {
+        vector<cv::Point> start;    // Frame coordinates where each scanline starts.
+        vector<cv::Point> leftEnd;  // First edge left of start; x is -1 if there is none.
+        vector<cv::Point> rightEnd; // First edge right of start; x is the frame width if there is none.
+        double steering;
+        double speed;
+        bool intersection;          // Set by the steering rule or by a confident stop line.
+        double intersectionConfidence; // Share of the vertical probes that first meet a horizontal run.
+        double confidence;          // Share of searched scanline ends that hit a lane marking.
+        int64_t acquired;           // Copied from the frame.
+        int64_t captured;           // Copied from the frame.
+        int64_t grayMicroseconds;   // Gray conversion on its own; -1 if the detector fuses it with the edges.
+        int64_t edgesMicroseconds;
+        int64_t scanMicroseconds;   // Scanlines, tracking and steering.
+    };
+
+    class InversePerspectiveMap;
+
+    // Every per-frame intermediate buffer, allocated once with SIMD friendly alignment and only
+    // reallocated when the geometry of the shared image changes.
+    class FrameWorkspace {
+        private:
+            /**
+             * "Forbidden" copy constructor. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the copy constructor.
+             */
+            FrameWorkspace(const FrameWorkspace &);
+
+            /**
+             * "Forbidden" assignment operator. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the assignment operator.
+             */
+            FrameWorkspace& operator=(const FrameWorkspace &);
+
+        public:
+            enum {
+                ALIGNMENT = 64 // Cache line; also enough for AVX2 and NEON loads.
+            };
+
+            FrameWorkspace() :
+                band(),
+                gray(),
+                edges(),
+                lumaRows(),
+                m_bandMemory(NULL),
+                m_grayMemory(NULL),
+                m_edgesMemory(NULL),
+                m_lumaRowsMemory(NULL),
+                m_allocations(0),
+                m_frames(0),
+                m_reallocatedFrames(0),
+                m_grayData(NULL),
+                m_edgesData(NULL) {}
+
+            ~FrameWorkspace() {
+                free(m_bandMemory);
+                free(m_grayMemory);
+                free(m_edgesMemory);
+                free(m_lumaRowsMemory);
+            }
+
+            // BGR rows copied from the shared memory; rows are contiguous so that a band is a single memcpy.
+            cv::Mat& prepareBand(int32_t rows, int32_t cols) {
+                if ( (band.rows != rows) || (band.cols != cols) ) {
+                    band = allocate(rows, cols, CV_8UC3, false, m_bandMemory);
+                }
+                return band;
+            }
+
+            // Gray and edge buffers for an edge band of rows x cols pixels; every row starts aligned.
+            void prepareEdges(int32_t rows, int32_t cols) {
+                if ( (gray.rows != rows) || (gray.cols != cols) ) {
+                    gray = allocate(rows, cols, CV_8UC1, true, m_grayMemory);
+                    edges = allocate(rows, cols, CV_8UC1, true, m_edgesMemory);
+                    lumaRows = allocate(3, cols, CV_8UC1, true, m_lumaRowsMemory);
+                }
+                m_grayData = gray.data;
+                m_edgesData = edges.data;
+            }
+
+            // Called once per frame after the edge stage; notices if OpenCV had to replace one of the buffers.
+            void finishFrame() {
+                m_frames++;
+                if ( (gray.data != m_grayData) || (edges.data != m_edgesData) ) {
+                    m_reallocatedFrames++;
+                }
+            }
+
+            string toString() const {
+                stringstream sstr;
+                sstr << "Frame workspace: " << m_allocations << " allocations, " << m_frames << " frames, "
+                     << m_reallocatedFrames << " frames with reallocated buffers.";
+                return sstr.str();
+            }
+
+            cv::Mat band;
+            cv::Mat gray;
+            cv::Mat edges;
+            cv::Mat lumaRows; // The three luma rows the fused edge kernel streams through.
+
+        private:
+            cv::Mat allocate(int32_t rows, int32_t cols, int type, bool alignRows, void *&memory) {
+                free(memory);
+                memory = NULL;
+                const size_t rowBytes = cols * CV_ELEM_SIZE(type);
+                const size_t step = alignRows ? ((rowBytes + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT : rowBytes;
+                if (posix_memalign(&memory, ALIGNMENT, step * rows) != 0) {
+                    memory = NULL;
+                    return cv::Mat(rows, cols, type);
+                }
+                m_allocations++;
+                return cv::Mat(rows, cols, type, memory, step);
+            }
+
+            void *m_bandMemory;
+            void *m_grayMemory;
+            void *m_edgesMemory;
+            void *m_lumaRowsMemory;
+            uint32_t m_allocations;
+            uint32_t m_frames;
+            uint32_t m_reallocatedFrames;
+            const uchar *m_grayData;
+            const uchar *m_edgesData;
+    };
+
+    /**
+     * Finds the lane markings along the scanlines of a frame and turns
+     * them into a steering and speed command. An instance keeps its
+     * buffers, tracks and last command to itself and neither reads
+     * configuration nor sends or prints anything, so independent
+     * instances can run on different frames in different threads.
+     */
+    class LaneFeatureExtractor {
+        private:
+            /**
+             * "Forbidden" copy constructor. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the copy constructor.
+             */
+            LaneFeatureExtractor(const LaneFeatureExtractor &);
+
+            /**
+             * "Forbidden" assignment operator. Goal: The compiler should warn
+             * already at compile time for unwanted bugs caused by any misuse
+             * of the assignment operator.
+             */
+            LaneFeatureExtractor& operator=(const LaneFeatureExtractor &);
+
+        public:
+            LaneFeatureExtractor();
+
+            explicit LaneFeatureExtractor(const LaneFeatureExtractorConfiguration &configuration);
+
+            /**
+             * Replaces the configuration and forgets the tracks and the last command.
+             */
+            void configure(const LaneFeatureExtractorConfiguration &configuration);
+
+            const LaneFeatureExtractorConfiguration& getConfiguration() const;
+
+            /**
+             * While shedding, findFeatures skips the optional work: refining
+             * the hits and the scanlines the steering rule does not look at.
+             */
+            void setShedding(bool shedding);
+
+            bool isShedding() const;
+
+            /**
+             * With a compiled map, the scanlines are the rows of the bird's-eye
+             * strip and the command follows the right line in metres; NULL
+             * goes back to the frame rows. The map must outlive its use here.
+             */
+            void setPerspective(const InversePerspectiveMap *perspective);
+
+            /**
+             * True if the last findFeatures scanned the bird's-eye strip; false
+             * without a perspective or if its calibration does not fit the
+             * frame, in which case the frame rows were scanned instead.
+             */
+            bool isPerspectiveBound() const;
+
+            /**
+             * Bird's-eye strip of the last findFeatures; empty without a perspective.
+             */
+            const cv::Mat& getBirdsEye() const;
+
+            /**
+             * Rows a frame must hold above roiTop and below roiBottom for the configured edge detector.
+             */
+            int32_t getEdgeMargin() const;
+
+            /**
+             * Computes the edge map of frame. Unless refineHits is set,
+             * frame.pixels is not read any more afterwards.
+             */
+            void detectEdges(const FrameView &frame, LaneFeatures &features);
+
+            /**
+             * Searches the scanlines in the edge map of the last detectEdges
+             * and derives the command.
+             */
+            void findFeatures(LaneFeatures &features);
+
+            /**
+             * detectEdges followed by findFeatures.
+             */
+            void extract(const FrameView &frame, LaneFeatures &features);
+
+            /**
+             * Edge map of the last detectEdges, in frame coordinates.
+             */
+            const FrameView& getEdges() const;
+
+            FrameWorkspace& getWorkspace();
+
+        private:
+            void resetTracks();
+            bool bindPerspective();
+            void findBirdsEyeFeatures(LaneFeatures &features);
+            void findStopLine(LaneFeatures &features);
+            void steer(LaneFeatures &features);
+            void steerMetric(LaneFeatures &features, const vector<int32_t> &scanlines);
+
+            LaneFeatureExtractorConfiguration m_configuration;
+            FrameWorkspace m_workspace;
+            FrameView m_band;  // Full resolution part of the frame the edges were computed from.
+            FrameView m_edges;
+            vector<LaneTrack> m_leftTracks;
+            vector<LaneTrack> m_rightTracks;
+            vector<int32_t> m_allScanlines;
+            vector<int32_t> m_steeringScanlines; // Scanline 0 and those with a left threshold.
+            vector<uchar> m_horizontalRuns;     // Per edge band row: is it a horizontal run across the lane?
+            const InversePerspectiveMap *m_perspective;
+            FrameView m_boundEdges;             // Storage geometry m_perspectiveOffsets were bound to.
+            bool m_perspectiveBound;
+            vector<int32_t> m_perspectiveOffsets;
+            vector<int32_t> m_allStripRows;
+            vector<int32_t> m_reducedStripRows; // Every second strip row, while shedding.
+            cv::Mat m_birdsEye;
+            bool m_shedding;
+            double m_steering; // Kept while the right line is lost but the left one is not.
+            double m_speed;
+    };
+
+    /**
+     * Compares the vectorized edge search with the pixel by pixel walk on
+     * synthetic edge rows and prints the timings.
+     */
+    void benchmarkEdgeSearch(int32_t iterations);
+
+    /**
+     * Compares cvtColor + Canny with every available variant of the fused
+     * kernel on a synthetic band and prints the timings.
+     */
+    void benchmarkEdgeDetectors(const LaneFeatureExtractorConfiguration &configuration, int32_t iterations);
+
+} // msv
+
+#endif /*LANEFEATUREEXTRACTOR_H_*/
@@ -0,0 +1,200 @@
+/**
+ * LatencyHistogram.h - Per-stage latency statistics for lanedetector and driver.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef LATENCYHISTOGRAM_H_
+#define LATENCYHISTOGRAM_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace msv {
+
+    using namespace std;
+
+    /**
+     * Monotonic clock in microseconds; cheap enough to be read around every stage of a frame.
+     */
+    inline int64_t monotonicMicroseconds() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    /**
+     * Histogram of latencies in microseconds with fixed buckets: exact up to
+     * 7 us, then eight buckets per power of two (at most 12.5% error).
+     * Adding a value never allocates.
+     */
+    class LatencyHistogram {
+        public:
+            enum {
+                SUB_BUCKETS = 8,
+                NUMBER_OF_BUCKETS = 30 * SUB_BUCKETS
+            };
+
+            LatencyHistogram() :
+                m_count(0),
+                m_sum(0),
+                m_maximum(0) {
+                reset();
+            }
+
+            void reset() {
+                for (uint32_t i = 0; i < NUMBER_OF_BUCKETS; i++) {
+                    m_buckets[i] = 0;
+                }
+                m_count = 0;
+                m_sum = 0;
+                m_maximum = 0;
+            }
+
+            void add(int64_t microseconds) {
+                const uint32_t v = (microseconds < 0) ? 0 : ((microseconds > 0x7FFFFFFF) ? 0x7FFFFFFF : static_cast<uint32_t>(microseconds));
+                m_buckets[bucketOf(v)]++;
+                m_count++;
+                m_sum += v;
+                m_maximum = (v > m_maximum) ? v : m_maximum;
+            }
+
+            // Adds all values of other, e.g. to summarise histograms filled by different threads.
+            void merge(const LatencyHistogram &other) {
+                for (uint32_t i = 0; i < NUMBER_OF_BUCKETS; i++) {
+                    m_buckets[i] += other.m_buckets[i];
+                }
+                m_count += other.m_count;
+                m_sum += other.m_sum;
+                m_maximum = (other.m_maximum > m_maximum) ? other.m_maximum : m_maximum;
+            }
+
+            uint64_t getCount() const {
+                return m_count;
+            }
+
+            uint32_t getMaximum() const {
+                return m_maximum;
+            }
+
+            double getMean() const {
+                return (m_count > 0) ? static_cast<double>(m_sum) / m_count : 0;
+            }
+
+            /**
+             * Returns the upper end of the bucket holding the given percentile (0..100).
+             */
+            uint32_t getPercentile(double percentile) const {
+                if (m_count == 0) {
+                    return 0;
+                }
+                const uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * (m_count - 1)) + 1;
+                uint64_t seen = 0;
+                for (uint32_t i = 0; i < NUMBER_OF_BUCKETS; i++) {
+                    seen += m_buckets[i];
+                    if (seen >= rank) {
+                        const uint32_t upper = lowerBoundOf(i + 1) - 1;
+                        return (upper < m_maximum) ? upper : m_maximum;
+                    }
+                }
+                return m_maximum;
+            }
+
+        private:
+            static uint32_t bucketOf(uint32_t v) {
+                if (v < SUB_BUCKETS) {
+                    return v;
+                }
+                const uint32_t exponent = 31 - __builtin_clz(v);
+                const uint32_t sub = (v >> (exponent - 3)) & (SUB_BUCKETS - 1);
+                return (exponent - 2) * SUB_BUCKETS + sub;
+            }
+
+            static uint32_t lowerBoundOf(uint32_t bucket) {
+                if (bucket < SUB_BUCKETS) {
+                    return bucket;
+                }
+                const uint32_t exponent = bucket / SUB_BUCKETS + 2;
+                const uint32_t sub = bucket % SUB_BUCKETS;
+                return static_cast<uint32_t>((static_cast<uint64_t>(SUB_BUCKETS + sub) << (exponent - 3)) & 0xFFFFFFFF);
+            }
+
+            uint32_t m_buckets[NUMBER_OF_BUCKETS];
+            uint64_t m_count;
+            uint64_t m_sum;
+            uint32_t m_maximum;
+    };
+
+    /**
+     * One histogram per named processing stage. Every stage must only be
+     * recorded from one thread at a time.
+     */
+    class LatencyRecorder {
+        public:
+            LatencyRecorder(const char * const *stageNames, uint32_t numberOfStages) :
+                m_names(stageNames, stageNames + numberOfStages),
+                m_histograms(numberOfStages) {}
+
+            void record(uint32_t stage, int64_t microseconds) {
+                m_histograms[stage].add(microseconds);
+            }
+
+            const LatencyHistogram& getHistogram(uint32_t stage) const {
+                return m_histograms[stage];
+            }
+
+            /**
+             * One line per stage with count, p50, p99 and maximum in microseconds.
+             */
+            string toString() const {
+                stringstream sstr;
+                for (uint32_t i = 0; i < m_histograms.size(); i++) {
+                    const LatencyHistogram &h = m_histograms[i];
+                    sstr << m_names[i] << ": n=" << h.getCount() << " p50=" << h.getPercentile(50)
+                         << "us p99=" << h.getPercentile(99) << "us max=" << h.getMaximum() << "us" << "\n";
+                }
+                return sstr.str();
+            }
+
+            /**
+             * Writes stage,count,mean_us,p50_us,p99_us,max_us rows to fileName.
+             */
+            bool writeCSV(const string &fileName) const {
+                ofstream out(fileName.c_str());
+                if (!out.good()) {
+                    return false;
+                }
+                out << "stage,count,mean_us,p50_us,p99_us,max_us" << "\n";
+                for (uint32_t i = 0; i < m_histograms.size(); i++) {
+                    const LatencyHistogram &h = m_histograms[i];
+                    out << m_names[i] << "," << h.getCount() << "," << h.getMean() << "," << h.getPercentile(50)
+                        << "," << h.getPercentile(99) << "," << h.getMaximum() << "\n";
+                }
+                return out.good();
+            }
+
+        private:
+            vector<string> m_names;
+            vector<LatencyHistogram> m_histograms;
+    };
+
+} // msv
+
+#endif /*LATENCYHISTOGRAM_H_*/
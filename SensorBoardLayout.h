@@ -0,0 +1,160 @@
+/**
+ * SensorBoardLayout.h - Fixed-layout sensor board readings for driver.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SENSORBOARDLAYOUT_H_
+#define SENSORBOARDLAYOUT_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "GeneratedHeaders_Data.h"
+
+namespace msv {
+
+    using namespace std;
+
+    /**
+     * Distances of the sensor board indexed by sensor id, plus a bit per
+     * sensor telling whether its distance is valid. Plain data: copying,
+     * encoding and decoding it never allocates.
+     */
+    struct SensorReadings {
+        enum {
+            MAX_SENSORS = 8,
+            // Encoded size: validMask, numberOfSensors and the distances.
+            ENCODED_SIZE = 2 * sizeof(uint32_t) + MAX_SENSORS * sizeof(double)
+        };
+
+        uint32_t validMask;
+        uint32_t numberOfSensors;
+        double distances[MAX_SENSORS];
+
+        SensorReadings() :
+            validMask(0),
+            numberOfSensors(0) {
+            for (uint32_t i = 0; i < MAX_SENSORS; i++) {
+                distances[i] = 0;
+            }
+        }
+
+        bool isValid(uint32_t sensor) const {
+            return (sensor < MAX_SENSORS) && ((validMask >> sensor) & 1);
+        }
+
+        void set(uint32_t sensor, double distance) {
+            if (sensor < MAX_SENSORS) {
+                distances[sensor] = distance;
+                validMask |= (1u << sensor);
+            }
+        }
+
+        string toString() const {
+            stringstream sstr;
+            for (uint32_t i = 0; i < MAX_SENSORS; i++) {
+                if (isValid(i)) {
+                    sstr << i << "=" << distances[i] << " ";
+                }
+            }
+            return sstr.str();
+        }
+    };
+
+    /**
+     * Writes readings into buffer in host byte order; returns the number
+     * of bytes written or 0 if the buffer is too small.
+     */
+    inline uint32_t encodeSensorReadings(const SensorReadings &readings, char *buffer, uint32_t size) {
+        if (size < SensorReadings::ENCODED_SIZE) {
+            return 0;
+        }
+        memcpy(buffer, &readings.validMask, sizeof(uint32_t));
+        memcpy(buffer + sizeof(uint32_t), &readings.numberOfSensors, sizeof(uint32_t));
+        memcpy(buffer + 2 * sizeof(uint32_t), readings.distances, sizeof(readings.distances));
+        return SensorReadings::ENCODED_SIZE;
+    }
+
+    /**
+     * Reads what encodeSensorReadings wrote; returns false if buffer is too short.
+     */
+    inline bool decodeSensorReadings(const char *buffer, uint32_t size, SensorReadings &readings) {
+        if (size < SensorReadings::ENCODED_SIZE) {
+            return false;
+        }
+        memcpy(&readings.validMask, buffer, sizeof(uint32_t));
+        memcpy(&readings.numberOfSensors, buffer + sizeof(uint32_t), sizeof(uint32_t));
+        memcpy(readings.distances, buffer + 2 * sizeof(uint32_t), sizeof(readings.distances));
+        return true;
+    }
+
+    /**
+     * Compatibility path for recordings and sensor boards that still send
+     * the map based SensorBoardData; ids beyond MAX_SENSORS are ignored.
+     */
+    inline SensorReadings toSensorReadings(const SensorBoardData &sbd) {
+        SensorReadings readings;
+        readings.numberOfSensors = sbd.getNumberOfSensors();
+        const map<uint32_t, double> distances = sbd.getMapOfDistances();
+        for (map<uint32_t, double>::const_iterator it = distances.begin(); it != distances.end(); ++it) {
+            readings.set(it->first, it->second);
+        }
+        return readings;
+    }
+
+    /**
+     * Decodes the fixed layout message msv.SensorBoardReadings.
+     */
+    inline SensorReadings toSensorReadings(const SensorBoardReadings &sbr) {
+        SensorReadings readings;
+        readings.validMask = sbr.getValidSensors();
+        readings.numberOfSensors = sbr.getNumberOfSensors();
+        readings.distances[0] = sbr.getDistance0();
+        readings.distances[1] = sbr.getDistance1();
+        readings.distances[2] = sbr.getDistance2();
+        readings.distances[3] = sbr.getDistance3();
+        readings.distances[4] = sbr.getDistance4();
+        readings.distances[5] = sbr.getDistance5();
+        readings.distances[6] = sbr.getDistance6();
+        readings.distances[7] = sbr.getDistance7();
+        return readings;
+    }
+
+    /**
+     * Encodes readings as the fixed layout message msv.SensorBoardReadings.
+     */
+    inline SensorBoardReadings toSensorBoardReadings(const SensorReadings &readings) {
+        SensorBoardReadings sbr;
+        sbr.setValidSensors(readings.validMask);
+        sbr.setNumberOfSensors(readings.numberOfSensors);
+        sbr.setDistance0(readings.distances[0]);
+        sbr.setDistance1(readings.distances[1]);
+        sbr.setDistance2(readings.distances[2]);
+        sbr.setDistance3(readings.distances[3]);
+        sbr.setDistance4(readings.distances[4]);
+        sbr.setDistance5(readings.distances[5]);
+        sbr.setDistance6(readings.distances[6]);
+        sbr.setDistance7(readings.distances[7]);
+        return sbr;
+    }
+
+} // msv
+
+#endif /*SENSORBOARDLAYOUT_H_*/
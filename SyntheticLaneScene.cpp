@@ -0,0 +1,186 @@
+/**
+ * SyntheticLaneScene.cpp - Rendered lane scenes for feeding lanedetector without a camera.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "opencv2/core/core.hpp"
+
+#include "SyntheticLaneScene.h"
+#include <math.h>
+#include <string.h>
+
+using namespace cv;
+
+namespace msv {
+
+    // Geometry of the 640x480 reference view: the lines meet at the vanishing point on the horizon
+    // and are 105 (right) and 90 (centre) pixels away from the image centre on scanline 0 (row 275).
+    const double REFERENCE_WIDTH = 640;
+    const double REFERENCE_HEIGHT = 480;
+    const double HORIZON = 200;
+    const double RIGHT_SLOPE = 105.0 / 75.0;  // Columns per row below the horizon.
+    const double CENTRE_SLOPE = -90.0 / 75.0;
+    const double DASH_LENGTH = 30;            // Rows of a dash and of a gap, at the bottom of the image.
+    const double INTERSECTION_TOP = 240;      // The lines are missing from here ...
+    const double INTERSECTION_BOTTOM = 380;   // ... to here.
+    const double STOP_LINE = 305;             // Top row of the stop line, between scanlines 1 and 2.
+    const uchar FLOOR = 45;
+    const uchar MARKING = 225;
+
+    const char *SCENE_KIND_NAMES[NUMBER_OF_SCENE_KINDS] = { "straight", "curved", "dashed", "noright", "intersection" };
+
+    const char* getSceneKindName(SceneKind kind) {
+        return SCENE_KIND_NAMES[kind];
+    }
+
+    bool parseSceneKind(const string &name, SceneKind &kind) {
+        for (int32_t i = 0; i < NUMBER_OF_SCENE_KINDS; i++) {
+            if (name == SCENE_KIND_NAMES[i]) {
+                kind = static_cast<SceneKind>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    SceneParameters::SceneParameters() :
+        kind(SCENE_STRAIGHT),
+        width(640),
+        height(480),
+        curvature(0.5),
+        noise(0),
+        glare(0),
+        seed(1) {}
+
+    SyntheticLaneScene::SyntheticLaneScene(const SceneParameters &parameters) :
+        m_parameters(parameters),
+        m_upright() {}
+
+    const SceneParameters& SyntheticLaneScene::getParameters() const {
+        return m_parameters;
+    }
+
+    void SyntheticLaneScene::render(uint32_t frame, Mat &image) {
+        const SceneParameters &p = m_parameters;
+        image.create(p.height, p.width, CV_8UC3);
+        image.setTo(Scalar::all(FLOOR));
+
+        const bool intersection = (p.kind == SCENE_INTERSECTION);
+        const int32_t gapTop = intersection ? cvRound(INTERSECTION_TOP * p.height / REFERENCE_HEIGHT) : -1;
+        const int32_t gapBottom = intersection ? cvRound(INTERSECTION_BOTTOM * p.height / REFERENCE_HEIGHT) : -1;
+        if (p.kind != SCENE_NO_RIGHT_LINE) {
+            drawLine(image, RIGHT_SLOPE, false, frame, gapTop, gapBottom);
+        }
+        drawLine(image, CENTRE_SLOPE, (p.kind == SCENE_DASHED), frame, gapTop, gapBottom);
+        if (intersection) {
+            const int32_t top = cvRound(STOP_LINE * p.height / REFERENCE_HEIGHT);
+            const int32_t bottom = min(p.height - 1, top + cvRound(12 * p.height / REFERENCE_HEIGHT));
+            image.rowRange(min(top, bottom), bottom + 1).setTo(Scalar::all(MARKING));
+        }
+
+        if (p.glare > 0) {
+            addGlare(image);
+        }
+        if (p.noise > 0) {
+            addNoise(image, frame);
+        }
+    }
+
+    void SyntheticLaneScene::renderSharedImage(uint32_t frame, char *buffer) {
+        render(frame, m_upright);
+        const SceneParameters &p = m_parameters;
+        // The camera is mounted upside down: raw row r is frame row height - 1 - r, read backwards.
+        for (int32_t r = 0; r < p.height; r++) {
+            const uchar *in = m_upright.ptr<uchar>(p.height - 1 - r);
+            uchar *out = reinterpret_cast<uchar*>(buffer) + r * p.width * 3;
+            for (int32_t x = 0; x < p.width; x++) {
+                memcpy(out + 3 * x, in + 3 * (p.width - 1 - x), 3);
+            }
+        }
+    }
+
+    // Draws one line from the bottom of the image towards the vanishing point, slope columns away from
+    // the centre per row below the horizon; its width shrinks with the distance.
+    void SyntheticLaneScene::drawLine(Mat &image, double slope, bool dashed, uint32_t frame, int32_t gapTop, int32_t gapBottom) const {
+        const SceneParameters &p = m_parameters;
+        const double sx = p.width / REFERENCE_WIDTH;
+        const double sy = p.height / REFERENCE_HEIGHT;
+        const int32_t horizon = cvRound(HORIZON * sy);
+        for (int32_t y = horizon; y < p.height; y++) {
+            if ( (y >= gapTop) && (y <= gapBottom) ) {
+                continue;
+            }
+            // Row in the reference view and its distance below the horizon.
+            const double ry = y / sy;
+            const double below = ry - HORIZON;
+            if (dashed) {
+                // Dashes get shorter towards the horizon and move down by one reference row per frame.
+                const double phase = (REFERENCE_HEIGHT - HORIZON) * log((REFERENCE_HEIGHT - HORIZON) / max(below, 1.0)) + frame;
+                if (static_cast<int64_t>(phase / DASH_LENGTH) % 2 == 1) {
+                    continue;
+                }
+            }
+            double centre = REFERENCE_WIDTH / 2 + slope * below;
+            if (p.kind == SCENE_CURVED) {
+                // The lane bends by curvature lane widths at the horizon, quadratically with the distance.
+                const double distance = (REFERENCE_HEIGHT - ry) / (REFERENCE_HEIGHT - HORIZON);
+                centre += p.curvature * (RIGHT_SLOPE - CENTRE_SLOPE) * 75 * distance * distance;
+            }
+            const double halfWidth = 1 + 0.04 * below;
+            const int32_t left = max(0, cvRound((centre - halfWidth) * sx));
+            const int32_t right = min(p.width - 1, cvRound((centre + halfWidth) * sx));
+            if (left <= right) {
+                memset(image.ptr<uchar>(y) + 3 * left, MARKING, 3 * (right - left + 1));
+            }
+        }
+    }
+
+    // Brightens a disc next to the right line with a linear falloff, like sun on a glossy floor.
+    void SyntheticLaneScene::addGlare(Mat &image) const {
+        const SceneParameters &p = m_parameters;
+        const double cx = 0.72 * p.width;
+        const double cy = 0.62 * p.height;
+        const double radius = 0.12 * p.height;
+        const int32_t top = max(0, static_cast<int32_t>(cy - radius));
+        const int32_t bottom = min(p.height - 1, static_cast<int32_t>(cy + radius));
+        const int32_t left = max(0, static_cast<int32_t>(cx - radius));
+        const int32_t right = min(p.width - 1, static_cast<int32_t>(cx + radius));
+        for (int32_t y = top; y <= bottom; y++) {
+            uchar *row = image.ptr<uchar>(y);
+            for (int32_t x = left; x <= right; x++) {
+                const double d = sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
+                if (d < radius) {
+                    const int32_t add = cvRound(p.glare * 255 * (1 - d / radius));
+                    for (int32_t c = 0; c < 3; c++) {
+                        row[3 * x + c] = static_cast<uchar>(min(255, row[3 * x + c] + add));
+                    }
+                }
+            }
+        }
+    }
+
+    // Adds gaussian noise that differs from frame to frame but is the same for the same seed and frame.
+    void SyntheticLaneScene::addNoise(Mat &image, uint32_t frame) const {
+        RNG rng(static_cast<uint64>(m_parameters.seed) * 2654435761u + frame);
+        for (int32_t y = 0; y < image.rows; y++) {
+            uchar *row = image.ptr<uchar>(y);
+            for (int32_t x = 0; x < image.cols * 3; x++) {
+                row[x] = saturate_cast<uchar>(row[x] + rng.gaussian(m_parameters.noise));
+            }
+        }
+    }
+
+} // msv
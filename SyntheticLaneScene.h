@@ -0,0 +1,91 @@
+/**
+ * SyntheticLaneScene.h - Rendered lane scenes for feeding lanedetector without a camera.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SYNTHETICLANESCENE_H_
+#define SYNTHETICLANESCENE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+namespace msv {
+
+    using namespace std;
+
+    enum SceneKind {
+        SCENE_STRAIGHT = 0,     // Solid right line, solid centre line.
+        SCENE_CURVED = 1,       // Both lines bend to one side towards the horizon.
+        SCENE_DASHED = 2,       // Dashed centre line that moves towards the car from frame to frame.
+        SCENE_NO_RIGHT_LINE = 3,
+        SCENE_INTERSECTION = 4, // Both lines are missing around the scanlines; a stop line crosses the gap.
+        NUMBER_OF_SCENE_KINDS
+    };
+
+    const char* getSceneKindName(SceneKind kind);
+
+    // Sets kind to the one called name; returns false and leaves kind alone for unknown names.
+    bool parseSceneKind(const string &name, SceneKind &kind);
+
+    struct SceneParameters {
+        SceneParameters();
+
+        SceneKind kind;
+        int32_t width;
+        int32_t height;
+        double curvature; // Lateral shift at the horizon in widths of the lane (SCENE_CURVED).
+        double noise;     // Standard deviation of the per pixel noise in gray levels.
+        double glare;     // Brightness of the glare spot next to the right line, 0 (none) to 1.
+        uint32_t seed;    // Seed of the noise.
+    };
+
+    /**
+     * Renders a camera view of a lane. The geometry is defined for
+     * 640x480, where it matches the tuned scanline defaults, and is
+     * scaled to the configured resolution.
+     */
+    class SyntheticLaneScene {
+        public:
+            SyntheticLaneScene(const SceneParameters &parameters);
+
+            const SceneParameters& getParameters() const;
+
+            /**
+             * Renders frame number frame (the dashes move with it) the right way up.
+             */
+            void render(uint32_t frame, cv::Mat &image);
+
+            /**
+             * Renders frame number frame as the camera delivers it to a SharedImage:
+             * BGR, rotated by 180 degrees, into width * height * 3 bytes at buffer.
+             */
+            void renderSharedImage(uint32_t frame, char *buffer);
+
+        private:
+            void drawLine(cv::Mat &image, double slope, bool dashed, uint32_t frame, int32_t gapTop, int32_t gapBottom) const;
+            void addGlare(cv::Mat &image) const;
+            void addNoise(cv::Mat &image, uint32_t frame) const;
+
+            SceneParameters m_parameters;
+            cv::Mat m_upright;
+    };
+
+} // msv
+
+#endif /*SYNTHETICLANESCENE_H_*/
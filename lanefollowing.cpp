@@ -17,7 +17,10 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <vector>
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 #include "opencv2/core/core.hpp"
@@ -25,15 +28,33 @@
 #include "opencv2/imgproc/imgproc.hpp"
 
 #include "core/macros.h"
+#include "core/SharedPointer.h"
 #include "core/base/KeyValueConfiguration.h"
+#include "core/base/KeyValueDataStore.h"
+#include "core/base/Lock.h"
+#include "core/base/Mutex.h"
+#include "core/base/Service.h"
+#include "core/base/Thread.h"
 #include "core/data/Container.h"
+#include "core/data/TimeStamp.h"
 #include "core/data/image/SharedImage.h"
 #include "core/io/ContainerConference.h"
+#include "core/io/URL.h"
 #include "core/wrapper/SharedMemoryFactory.h"
 #include "tools/player/Player.h"
 #include "GeneratedHeaders_Data.h"
+#include "AsyncLog.h"
+#include "FleetEvaluation.h"
+#include "FrameBand.h"
+#include "FrameLog.h"
+#include "InversePerspective.h"
 #include "LaneDetector.h"
+#include "LaneFeatureExtractor.h"
+#include "LatencyHistogram.h"
+#include "SyntheticLaneScene.h"
 #include <math.h> 
+#include <stdio.h>
+#include <stdlib.h>
 #define PI 3.14159265
 
 using namespace cv;
@@ -46,10 +67,239 @@ namespace msv {
     using namespace core::data::image;
     using namespace tools::player;
 
-    SteeringData sd;
-    SpeedData spd;
     //bool intersection = false;
 
+    // How a frame is taken out of the shared memory segment.
+    enum AcquisitionMode {
+        ACQUIRE_FULL_FRAME = 0, // Copy the whole frame and mirror it with cvFlip (original behaviour).
+        ACQUIRE_ROI = 1,        // Copy only the configured row band; mirror by coordinate transform.
+        ACQUIRE_ZERO_COPY = 2   // Read the row band in place from the shared memory; no copy at all.
+    };
+
+    // Stages of a frame from the shared memory to the sent command.
+    enum LatencyStage {
+        STAGE_LOCK_WAIT = 0,
+        STAGE_MEMCPY,
+        STAGE_FLIP,
+        STAGE_GRAY,
+        STAGE_CANNY,
+        STAGE_SCAN,
+        STAGE_SEND,
+        STAGE_FRAME, // Whole frame, from acquisition to sending.
+        NUMBER_OF_LATENCY_STAGES
+    };
+
+    const char *LATENCY_STAGE_NAMES[NUMBER_OF_LATENCY_STAGES] = { "lock_wait", "memcpy", "flip", "gray", "canny", "scan", "send", "frame" };
+    LatencyRecorder latency(LATENCY_STAGE_NAMES, NUMBER_OF_LATENCY_STAGES);
+    string latencyFile; // CSV file written at tearDown; empty to skip it.
+
+    // Messages from the frame path go through logger; logWriter writes them between setUp and tearDown.
+    AsyncLog logger;
+    ofstream logFile;
+    AsyncLogWriter *logWriter = NULL;
+
+    // Binary record of every processed frame; open with lanedetector.framelog.file.
+    FrameLogWriter frameLog;
+
+    AcquisitionMode acquisitionMode = ACQUIRE_FULL_FRAME;
+    int32_t roiTop = 275;    // First frame row needed by the extractor.
+    int32_t roiBottom = 350; // Last frame row needed by the extractor.
+    int32_t bandMargin = 2;  // Rows acquired above roiTop and below roiBottom; see LaneFeatureExtractor::getEdgeMargin.
+    FrameView frameView;
+    core::wrapper::SharedMemory *lockedSharedMemory = NULL; // Still locked in ACQUIRE_ZERO_COPY.
+
+    // The lane algorithm itself; processImage only feeds it frames and sends what it finds.
+    LaneFeatureExtractor extractor;
+    LaneFeatures laneFeatures;
+    LaneFeatureExtractorConfiguration extractorConfiguration; // Read at setUp.
+    InversePerspectiveMap perspective; // Compiled at setUp with lanedetector.ipm.enabled=1.
+    bool perspectiveMismatch = false;  // The calibration did not fit the last frame; reported once per change.
+
+    // Returns the value for key or defaultValue if the configuration does not provide it.
+    template<typename T>
+    T getOptionalValue(const KeyValueConfiguration &kv, const string &key, const T &defaultValue) {
+        try {
+            return kv.getValue<T>(key);
+        }
+        catch(...) {
+            return defaultValue;
+        }
+    }
+
+    // Parses a comma separated list of integers like "214,191,-1,145".
+    vector<int32_t> parseIntegerList(const string &list) {
+        vector<int32_t> values;
+        stringstream sstr(list);
+        string item;
+        while (getline(sstr, item, ',')) {
+            stringstream value(item);
+            int32_t v = 0;
+            if (value >> v) {
+                values.push_back(v);
+            }
+        }
+        return values;
+    }
+
+    // Reads the edge detector called name; unknown names select Canny.
+    EdgeDetector readEdgeDetector(const string &name) {
+        EdgeDetector detector = EDGES_CANNY;
+        if (!parseEdgeDetector(name, detector)) {
+            cerr << "Unknown edge detector " << name << "; using canny." << endl;
+        }
+        return detector;
+    }
+
+    // Reads the settings of the lane algorithm; every key is optional and defaults to the tuned values.
+    LaneFeatureExtractorConfiguration readExtractorConfiguration(const KeyValueConfiguration &kv) {
+        LaneFeatureExtractorConfiguration c;
+        ScanlineGeometry &g = c.scanlines;
+        g.numberOfScanlines = max(1, getOptionalValue<int32_t>(kv, "lanedetector.scanlines.count", g.numberOfScanlines));
+        g.firstRow = getOptionalValue<int32_t>(kv, "lanedetector.scanlines.firstRow", g.firstRow);
+        g.spacing = getOptionalValue<int32_t>(kv, "lanedetector.scanlines.spacing", g.spacing);
+        g.startColumn = getOptionalValue<int32_t>(kv, "lanedetector.scanlines.startColumn", g.startColumn);
+        // The original rule never looked at the third scanline, hence the -1.
+        g.leftThresholds = parseIntegerList(getOptionalValue<string>(kv, "lanedetector.scanlines.leftThresholds", "214,191,-1,145"));
+        g.leftThresholds.resize(g.numberOfScanlines, -1);
+        g.rightLostColumn = getOptionalValue<int32_t>(kv, "lanedetector.steering.rightLostColumn", g.rightLostColumn);
+        g.laneOffset = getOptionalValue<int32_t>(kv, "lanedetector.steering.laneOffset", g.laneOffset);
+        g.desiredDistRight = getOptionalValue<int32_t>(kv, "lanedetector.steering.desiredDistRight", g.desiredDistRight);
+        g.parallelThreshold = getOptionalValue<int32_t>(kv, "lanedetector.scanlines.parallelThreshold", g.parallelThreshold);
+
+        c.tracking.enabled = getOptionalValue<int32_t>(kv, "lanedetector.tracking.enabled", 0) == 1;
+        c.tracking.window = getOptionalValue<int32_t>(kv, "lanedetector.tracking.window", c.tracking.window);
+        c.tracking.alpha = getOptionalValue<double>(kv, "lanedetector.tracking.alpha", c.tracking.alpha);
+        c.tracking.beta = getOptionalValue<double>(kv, "lanedetector.tracking.beta", c.tracking.beta);
+        c.tracking.maxMisses = getOptionalValue<int32_t>(kv, "lanedetector.tracking.maxMisses", c.tracking.maxMisses);
+
+        // By default the band spans exactly the scanlines.
+        c.roiTop = getOptionalValue<int32_t>(kv, "lanedetector.roi.top", min(g.firstRow, g.firstRow + (g.numberOfScanlines - 1) * g.spacing));
+        c.roiBottom = getOptionalValue<int32_t>(kv, "lanedetector.roi.bottom", max(g.firstRow, g.firstRow + (g.numberOfScanlines - 1) * g.spacing));
+        c.cannyLowThreshold = getOptionalValue<double>(kv, "lanedetector.canny.low", c.cannyLowThreshold);
+        c.cannyHighThreshold = getOptionalValue<double>(kv, "lanedetector.canny.high", c.cannyHighThreshold);
+        c.cannyAperture = getOptionalValue<int32_t>(kv, "lanedetector.canny.aperture", c.cannyAperture);
+        c.downscale = getOptionalValue<int32_t>(kv, "lanedetector.downscale", 1);
+        if ( (c.downscale != 1) && (c.downscale != 2) && (c.downscale != 4) ) {
+            cerr << "lanedetector.downscale must be 1, 2 or 4; using 1." << endl;
+            c.downscale = 1;
+        }
+        c.refineHits = (getOptionalValue<int32_t>(kv, "lanedetector.downscale.refine", 0) == 1);
+        c.edgeDetector = readEdgeDetector(getOptionalValue<string>(kv, "lanedetector.edges", "canny"));
+        c.markingThreshold.high = getOptionalValue<double>(kv, "lanedetector.edges.markingHigh", c.markingThreshold.high);
+        c.markingThreshold.low = getOptionalValue<double>(kv, "lanedetector.edges.markingLow", c.markingThreshold.low);
+        c.markingThreshold.minContrast = getOptionalValue<int32_t>(kv, "lanedetector.edges.minContrast", c.markingThreshold.minContrast);
+        c.markingThreshold.minWidth = getOptionalValue<int32_t>(kv, "lanedetector.edges.minWidth", c.markingThreshold.minWidth);
+        c.edgeThreshold = getOptionalValue<int32_t>(kv, "lanedetector.edges.threshold", static_cast<int32_t>(c.cannyHighThreshold));
+        c.intersection.enabled = getOptionalValue<int32_t>(kv, "lanedetector.intersection.enabled", 1) == 1;
+        c.intersection.probes = getOptionalValue<int32_t>(kv, "lanedetector.intersection.probes", c.intersection.probes);
+        c.intersection.halfWidth = getOptionalValue<int32_t>(kv, "lanedetector.intersection.halfWidth", c.intersection.halfWidth);
+        c.intersection.minFill = getOptionalValue<double>(kv, "lanedetector.intersection.minFill", c.intersection.minFill);
+        c.intersection.threshold = getOptionalValue<double>(kv, "lanedetector.intersection.threshold", c.intersection.threshold);
+        c.metricSteering.desiredRight = getOptionalValue<double>(kv, "lanedetector.ipm.desiredRight", c.metricSteering.desiredRight);
+        c.metricSteering.gain = getOptionalValue<double>(kv, "lanedetector.ipm.gain", c.metricSteering.gain);
+        const string kernel = getOptionalValue<string>(kv, "lanedetector.edges.kernel", "auto");
+        if (!findGradientKernel(kernel, c.gradientKernel)) {
+            cerr << "Gradient kernel " << kernel << " is not available; using " << c.gradientKernel.name << "." << endl;
+        }
+        return c;
+    }
+
+    // Reads the camera calibration for the bird's-eye strip; the defaults describe the car's camera at 640x480.
+    PerspectiveCalibration readPerspectiveCalibration(const KeyValueConfiguration &kv) {
+        PerspectiveCalibration c;
+        c.width = getOptionalValue<int32_t>(kv, "lanedetector.ipm.width", c.width);
+        c.height = getOptionalValue<int32_t>(kv, "lanedetector.ipm.height", c.height);
+        c.focalX = getOptionalValue<double>(kv, "lanedetector.ipm.focalX", c.focalX);
+        c.focalY = getOptionalValue<double>(kv, "lanedetector.ipm.focalY", c.focalY);
+        c.centreX = getOptionalValue<double>(kv, "lanedetector.ipm.centreX", c.centreX);
+        c.centreY = getOptionalValue<double>(kv, "lanedetector.ipm.centreY", c.centreY);
+        c.cameraHeight = getOptionalValue<double>(kv, "lanedetector.ipm.cameraHeight", c.cameraHeight);
+        c.pitch = getOptionalValue<double>(kv, "lanedetector.ipm.pitch", c.pitch);
+        c.lateralRange = getOptionalValue<double>(kv, "lanedetector.ipm.lateralRange", c.lateralRange);
+        c.metresPerPixel = getOptionalValue<double>(kv, "lanedetector.ipm.metresPerPixel", c.metresPerPixel);
+        c.rows = getOptionalValue<int32_t>(kv, "lanedetector.ipm.rows", c.rows);
+        return c;
+    }
+
+    // Microseconds to sleep when the newest SHARED_IMAGE has been processed already.
+    uint32_t idleSleep = 1000;
+
+    // Gives the shared memory back to the image producer once the zero-copy frame has been consumed.
+    void releaseLockedFrame() {
+        if (lockedSharedMemory != NULL) {
+            lockedSharedMemory->unlock();
+            lockedSharedMemory = NULL;
+        }
+    }
+
+    // Optional work is shed one level at a time when frames take longer than the budget; frames are dropped last.
+    enum LoadLevel {
+        LOAD_FULL = 0,
+        LOAD_NO_DEBUG = 1,     // No snapshots for the debug window.
+        LOAD_REDUCED_SCAN = 2, // Only the scanlines the steering rule looks at, no refinement.
+        LOAD_DROP_FRAMES = 3,  // Every second frame is dropped, too.
+        NUMBER_OF_LOAD_LEVELS
+    };
+
+    const char *LOAD_LEVEL_NAMES[NUMBER_OF_LOAD_LEVELS] = { "full", "no_debug", "reduced_scan", "drop_frames" };
+
+    struct DeadlineScheduler {
+        int64_t budget;            // Microseconds from acquiring a frame to its command; 0 never sheds anything.
+        double recoverShare;       // A frame within this share of the budget counts towards going back one level.
+        uint32_t recoverFrames;    // Frames in a row within recoverShare * budget before going back one level.
+        LoadLevel level;
+        uint32_t framesWithinShare;
+        bool dropNext;
+        uint32_t framesAtLevel[NUMBER_OF_LOAD_LEVELS];
+        uint32_t droppedFrames;
+    };
+
+    DeadlineScheduler scheduler = { 0, 0.6, 30, LOAD_FULL, 0, false, { 0, 0, 0, 0 }, 0 };
+
+    void setLoadLevel(LoadLevel level) {
+        if (level != scheduler.level) {
+            char text[LogRecord::MAX_TEXT];
+            snprintf(text, sizeof(text), "%s -> %s", LOAD_LEVEL_NAMES[scheduler.level], LOAD_LEVEL_NAMES[level]);
+            logger.logText(LOG_WARNING, "Frame budget: ", text);
+            scheduler.level = level;
+            scheduler.framesWithinShare = 0;
+            extractor.setShedding(level >= LOAD_REDUCED_SCAN);
+        }
+    }
+
+    // Moves one level up as soon as a frame misses the budget and one level down after recoverFrames fast frames.
+    void updateLoadLevel(int64_t frameMicroseconds) {
+        if (scheduler.budget <= 0) {
+            return;
+        }
+        scheduler.framesAtLevel[scheduler.level]++;
+        if (frameMicroseconds > scheduler.budget) {
+            if (scheduler.level + 1 < NUMBER_OF_LOAD_LEVELS) {
+                setLoadLevel(static_cast<LoadLevel>(scheduler.level + 1));
+            }
+            scheduler.framesWithinShare = 0;
+        }
+        else if (frameMicroseconds <= scheduler.recoverShare * scheduler.budget) {
+            scheduler.framesWithinShare++;
+            if ( (scheduler.framesWithinShare >= scheduler.recoverFrames) && (scheduler.level > LOAD_FULL) ) {
+                setLoadLevel(static_cast<LoadLevel>(scheduler.level - 1));
+            }
+        }
+        else {
+            scheduler.framesWithinShare = 0;
+        }
+    }
+
+    // Returns true if the current frame is to be dropped without processing it.
+    bool dropFrame() {
+        if (scheduler.level < LOAD_DROP_FRAMES) {
+            return false;
+        }
+        scheduler.dropNext = !scheduler.dropNext;
+        scheduler.droppedFrames += scheduler.dropNext ? 1 : 0;
+        return scheduler.dropNext;
+    }
+
     LaneDetector::LaneDetector(const int32_t &argc, char **argv) : ConferenceClientModule(argc, argv, "lanedetector"),
         m_hasAttachedToSharedImageMemory(false),
         m_sharedImageMemory(),
@@ -59,10 +309,42 @@ namespace msv {
     LaneDetector::~LaneDetector() {}
     void LaneDetector::setUp() {
         // This method will be call automatically _before_ running body().
-        if (m_debug) {
-            // Create an OpenCV-window.
-            cvNamedWindow("WindowShowImage", CV_WINDOW_AUTOSIZE);
-            cvMoveWindow("WindowShowImage", 300, 100);
+        // The debug window is owned by DebugVisualisation, which creates it in its own thread.
+        KeyValueConfiguration kv = getKeyValueConfiguration();
+        // lanedetector.log.level is debug, info, warning or error; lanedetector.log.file replaces stderr.
+        LogLevel logLevel = LOG_INFO;
+        const string logLevelName = getOptionalValue<string>(kv, "lanedetector.log.level", "info");
+        if (!parseLogLevel(logLevelName, logLevel)) {
+            cerr << "Unknown log level " << logLevelName << "; using info." << endl;
+        }
+        logger.setLevel(logLevel);
+        const string logFileName = getOptionalValue<string>(kv, "lanedetector.log.file", "");
+        if (!logFileName.empty()) {
+            logFile.open(logFileName.c_str());
+            if (logFile.is_open()) {
+                logger.setOutput(logFile);
+            }
+            else {
+                cerr << "Could not open " << logFileName << "; logging to stderr." << endl;
+            }
+        }
+        logWriter = new AsyncLogWriter(logger, 1000);
+        logWriter->start();
+
+        // lanedetector.framelog.chunk records are preallocated at a time; flushes start every flushInterval ms.
+        const string frameLogFile = getOptionalValue<string>(kv, "lanedetector.framelog.file", "");
+        if (!frameLogFile.empty() && !frameLog.open(frameLogFile, FRAME_LOG_LANEDETECTOR, getOptionalValue<uint32_t>(kv, "lanedetector.framelog.chunk", 65536),
+                                                    getOptionalValue<int64_t>(kv, "lanedetector.framelog.flushInterval", 1000) * 1000)) {
+            cerr << "Could not create the frame log " << frameLogFile << endl;
+        }
+
+        extractorConfiguration = readExtractorConfiguration(kv);
+        // The bird's-eye strip covers exactly the scanned band; all trigonometry happens here, once.
+        if (getOptionalValue<int32_t>(kv, "lanedetector.ipm.enabled", 0) == 1) {
+            if (!perspective.compile(readPerspectiveCalibration(kv), extractorConfiguration.roiTop, extractorConfiguration.roiBottom)) {
+                cerr << "The camera does not see the floor in rows " << extractorConfiguration.roiTop << " to "
+                     << extractorConfiguration.roiBottom << "; scanning frame rows instead." << endl;
+            }
         }
     }
 
@@ -71,10 +353,222 @@ namespace msv {
         if (m_image != NULL) {
             cvReleaseImage(&m_image);
         }
-        if (m_debug) {
-            cvDestroyWindow("WindowShowImage");
+        if (logWriter != NULL) {
+            // Writes whatever is still waiting before the summary below.
+            logWriter->stop();
+            OPENDAVINCI_CORE_DELETE_POINTER(logWriter);
+        }
+        if (frameLog.isOpen()) {
+            cerr << "Frame log holds " << frameLog.getCount() << " frames." << endl;
+            frameLog.close();
+        }
+        cerr << latency.toString();
+        cerr << extractor.getWorkspace().toString() << endl;
+        if (scheduler.budget > 0) {
+            cerr << "Frames per load level:";
+            for (uint32_t i = 0; i < NUMBER_OF_LOAD_LEVELS; i++) {
+                cerr << " " << LOAD_LEVEL_NAMES[i] << "=" << scheduler.framesAtLevel[i];
+            }
+            cerr << ", dropped " << scheduler.droppedFrames << " frames." << endl;
         }
+        if (!latencyFile.empty() && !latency.writeCSV(latencyFile)) {
+            cerr << "Could not write latencies to " << latencyFile << endl;
+        }
+    }
+    // Locates frame rows [roiTop, roiBottom] plus the Canny margin in the shared image si.
+    bool locateScannedBand(const SharedImage &si, FrameBand &band) {
+        return locateFrameBand(si, roiTop - bandMargin, roiBottom + bandMargin, band);
+    }
+
+    // Copies the scanned band out of the shared memory into target and records the lock wait and memcpy.
+    bool copyScannedBand(core::wrapper::SharedMemory &memory, const SharedImage &si, Mat &target, FrameView &view) {
+        FrameBandTimes times;
+        if (!copyFrameBand(memory, si, roiTop - bandMargin, roiBottom + bandMargin, target, view, times)) {
+            return false;
+        }
+        latency.record(STAGE_LOCK_WAIT, times.lockWait);
+        latency.record(STAGE_MEMCPY, times.copy);
+        return true;
     }
+
+    // Lock-free bounded queue between exactly one producer and one consumer thread; holds CAPACITY - 1 items.
+    template<typename T, uint32_t CAPACITY>
+    class SpscQueue {
+        public:
+            SpscQueue() :
+                m_items(),
+                m_head(0),
+                m_tail(0) {}
+
+            // Called by the producer only; returns false if the queue is full.
+            bool push(const T &item) {
+                const uint32_t tail = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+                const uint32_t next = (tail + 1) % CAPACITY;
+                if (next == __atomic_load_n(&m_head, __ATOMIC_ACQUIRE)) {
+                    return false;
+                }
+                m_items[tail] = item;
+                __atomic_store_n(&m_tail, next, __ATOMIC_RELEASE);
+                return true;
+            }
+
+            // Called by the consumer only; returns false if the queue is empty.
+            bool pop(T &item) {
+                const uint32_t head = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+                if (head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE)) {
+                    return false;
+                }
+                item = m_items[head];
+                __atomic_store_n(&m_head, (head + 1) % CAPACITY, __ATOMIC_RELEASE);
+                return true;
+            }
+
+            // Called by the consumer only; skips everything but the most recent item.
+            // Returns the number of items skipped in dropped.
+            bool popLatest(T &item, uint32_t &dropped) {
+                dropped = 0;
+                if (!pop(item)) {
+                    return false;
+                }
+                T newer;
+                while (pop(newer)) {
+                    item = newer;
+                    dropped++;
+                }
+                return true;
+            }
+
+        private:
+            T m_items[CAPACITY];
+            uint32_t m_head;
+            uint32_t m_tail;
+    };
+
+    // Steering and speed computed for one frame.
+    struct LaneCommand {
+        LaneFollowingCommand command;
+        int64_t acquired; // See FrameView::acquired.
+    };
+
+    // Preallocated storage for one frame travelling from acquisition to processing.
+    struct FrameSlot {
+        Mat buffer;
+        FrameView view;
+    };
+
+    // Three slots: one being filled, one waiting, one being processed.
+    const uint32_t NUMBER_OF_FRAME_SLOTS = 3;
+
+    // State shared by the stages of the pipelined mode (lanedetector.pipeline=1).
+    struct FramePipeline {
+        bool enabled;
+        FrameSlot slots[NUMBER_OF_FRAME_SLOTS];
+        SpscQueue<uint32_t, NUMBER_OF_FRAME_SLOTS + 1> freeSlots;  // Processing -> acquisition.
+        SpscQueue<uint32_t, NUMBER_OF_FRAME_SLOTS + 1> readySlots; // Acquisition -> processing.
+        SpscQueue<LaneCommand, 4> commands;                        // Processing -> publishing.
+        uint32_t duplicateFrames; // Written by acquisition only.
+        uint32_t droppedFrames;   // Written by processing only.
+        uint32_t droppedCommands; // Written by publishing only.
+    };
+
+    FramePipeline pipeline;
+
+    // Set when replaying a recording: processImage keeps its result in lastCommand instead of sending it.
+    bool headless = false;
+    LaneCommand lastCommand;
+
+    // Counts the frames processImage has finished.
+    uint32_t frameSequence = 0;
+
+    // Acquisition stage: copies the newest shared image into a free slot whenever one is available.
+    class FrameAcquisition : public Service {
+        public:
+            FrameAcquisition(KeyValueDataStore &keyValueDataStore) :
+                m_keyValueDataStore(keyValueDataStore),
+                m_sharedImageMemory(),
+                m_lastFrame(-1) {}
+
+            virtual void beforeStop() {}
+
+            virtual void run() {
+                serviceReady();
+                // Only processing pushes into freeSlots; a slot that stays empty is kept here for the next pass.
+                bool hasSlot = false;
+                uint32_t slot = 0;
+                while (isRunning()) {
+                    if (!hasSlot && !pipeline.freeSlots.pop(slot)) {
+                        // Processing holds all slots; it will return the ones it skips.
+                        Thread::usleepFor(500);
+                        continue;
+                    }
+                    hasSlot = true;
+
+                    bool acquired = false;
+                    Container c = m_keyValueDataStore.get(Container::SHARED_IMAGE);
+                    if ( (c.getDataType() == Container::SHARED_IMAGE) && (frameIdentity(c) == m_lastFrame) ) {
+                        pipeline.duplicateFrames++;
+                    }
+                    else if (c.getDataType() == Container::SHARED_IMAGE) {
+                        SharedImage si = c.getData<SharedImage> ();
+                        if (!m_sharedImageMemory.isValid() || !m_sharedImageMemory->isValid()) {
+                            m_sharedImageMemory = core::wrapper::SharedMemoryFactory::attachToSharedMemory(si.getName());
+                        }
+                        if (m_sharedImageMemory->isValid()) {
+                            FrameSlot &s = pipeline.slots[slot];
+                            acquired = copyScannedBand(*m_sharedImageMemory, si, s.buffer, s.view);
+                            s.view.captured = frameIdentity(c);
+                            m_lastFrame = frameIdentity(c);
+                        }
+                    }
+
+                    if (acquired) {
+                        pipeline.readySlots.push(slot);
+                        hasSlot = false;
+                    }
+                    else {
+                        Thread::usleepFor(idleSleep);
+                    }
+                }
+            }
+
+        private:
+            KeyValueDataStore &m_keyValueDataStore;
+            core::SharedPointer<core::wrapper::SharedMemory> m_sharedImageMemory;
+            int64_t m_lastFrame;
+    };
+
+    // Publishing stage: sends the most recent command and skips older ones.
+    class CommandPublisher : public Service {
+        public:
+            CommandPublisher(core::io::ContainerConference &conference) :
+                m_conference(conference) {}
+
+            virtual void beforeStop() {}
+
+            virtual void run() {
+                serviceReady();
+                while (isRunning()) {
+                    LaneCommand command;
+                    uint32_t dropped = 0;
+                    if (pipeline.commands.popLatest(command, dropped)) {
+                        pipeline.droppedCommands += dropped;
+                        const int64_t start = monotonicMicroseconds();
+                        Container c(Container::USER_DATA_3, command.command);
+                        m_conference.send(c);
+                        const int64_t sent = monotonicMicroseconds();
+                        latency.record(STAGE_SEND, sent - start);
+                        latency.record(STAGE_FRAME, sent - command.acquired);
+                    }
+                    else {
+                        Thread::usleepFor(500);
+                    }
+                }
+            }
+
+        private:
+            core::io::ContainerConference &m_conference;
+    };
+
     bool LaneDetector::readSharedImage(Container &c) {
         bool retVal = false;
         if (c.getDataType() == Container::SHARED_IMAGE) {
@@ -84,162 +578,487 @@ namespace msv {
                 m_sharedImageMemory
                         = core::wrapper::SharedMemoryFactory::attachToSharedMemory(
                                 si.getName());
+                m_hasAttachedToSharedImageMemory = m_sharedImageMemory->isValid();
             }
             // Check if we could successfully attach to the shared memory.
             if (m_sharedImageMemory->isValid()) {
-                // Lock the memory region to gain exclusive access. REMEMBER!!! DO NOT FAIL WITHIN lock() / unlock(), otherwise, the image producing process would fail.
-                m_sharedImageMemory->lock();{
-                    const uint32_t numberOfChannels = 3;
-                    // For example, simply show the image.
-                    if (m_image == NULL) {
-                        m_image = cvCreateImage(cvSize(si.getWidth(), si.getHeight()), IPL_DEPTH_8U, numberOfChannels);
+                const uint32_t numberOfChannels = 3;
+                const int32_t width = si.getWidth();
+                const int32_t height = si.getHeight();
+
+                if (acquisitionMode == ACQUIRE_FULL_FRAME) {
+                    const int64_t start = monotonicMicroseconds();
+                    // Lock the memory region to gain exclusive access. REMEMBER!!! DO NOT FAIL WITHIN lock() / unlock(), otherwise, the image producing process would fail.
+                    m_sharedImageMemory->lock();{
+                        const int64_t locked = monotonicMicroseconds();
+                        latency.record(STAGE_LOCK_WAIT, locked - start);
+                        // For example, simply show the image.
+                        if ( (m_image != NULL) && ((m_image->width != width) || (m_image->height != height)) ) {
+                            // The camera resolution changed.
+                            cvReleaseImage(&m_image);
+                        }
+                        if (m_image == NULL) {
+                            m_image = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, numberOfChannels);
+                        }
+                        // Copying the image data is very expensive...
+                        if (m_image != NULL) {
+                            memcpy(m_image->imageData,
+                                   m_sharedImageMemory->getSharedMemory(),
+                                   width * height * numberOfChannels);
+                        }
+                        latency.record(STAGE_MEMCPY, monotonicMicroseconds() - locked);
                     }
-                    // Copying the image data is very expensive...
-                    if (m_image != NULL) {
-                        memcpy(m_image->imageData,
-                               m_sharedImageMemory->getSharedMemory(),
-                               si.getWidth() * si.getHeight() * numberOfChannels);
+                    // Release the memory region so that the image produce (i.e. the camera for example) can provide the next raw image data.
+                    m_sharedImageMemory->unlock();
+                    // Mirror the image.
+                    const int64_t flipStart = monotonicMicroseconds();
+                    cvFlip(m_image, 0, -1);
+                    latency.record(STAGE_FLIP, monotonicMicroseconds() - flipStart);
+
+                    frameView.pixels = Mat(m_image);
+                    frameView.firstRow = 0;
+                    frameView.mirrored = false;
+                    frameView.scale = 1;
+                    frameView.acquired = start;
+                    retVal = true;
+                }
+                else if (acquisitionMode == ACQUIRE_ZERO_COPY) {
+                    FrameBand band;
+                    // A SharedImage describing more than its segment holds must not be read past the mapping.
+                    if (locateScannedBand(si, band) && (m_sharedImageMemory->getSize() >= band.offset + band.bytes)) {
+                        // Keep the lock: processImage reads the pixels in place and calls releaseLockedFrame()
+                        // as soon as it has converted them.
+                        const int64_t start = monotonicMicroseconds();
+                        m_sharedImageMemory->lock();
+                        latency.record(STAGE_LOCK_WAIT, monotonicMicroseconds() - start);
+                        char *pixels = static_cast<char*>(m_sharedImageMemory->getSharedMemory()) + band.offset;
+                        frameView.pixels = Mat(band.rows, width, CV_8UC3, pixels);
+                        frameView.firstRow = band.top;
+                        frameView.mirrored = true;
+                        frameView.scale = 1;
+                        frameView.acquired = start;
+                        lockedSharedMemory = &(*m_sharedImageMemory);
+                        retVal = true;
                     }
                 }
-                // Release the memory region so that the image produce (i.e. the camera for example) can provide the next raw image data.
-                m_sharedImageMemory->unlock();
-                // Mirror the image.
-                cvFlip(m_image, 0, -1);
-                retVal = true;
+                else {
+                    FrameBand band;
+                    if (locateScannedBand(si, band)) {
+                        retVal = copyScannedBand(*m_sharedImageMemory, si, extractor.getWorkspace().prepareBand(band.rows, width), frameView);
+                    }
+                }
+                frameView.captured = frameIdentity(c);
             }
         }
         return retVal;
 
     }
-/*-----------Nicolas--------------*/
-// finds the white line
-bool FindWhiteLine(Vec3b white)
-{ 
-    bool color =  false;
-    uchar blue,green,red;
-    blue = white.val[0];
-    green = white.val[1];
-    red = white.val[2];
-    if(blue == 255 && green == 255 && red == 255)
-            {
-                color = true;
-            }
-            return color;
-}
-// extends the line until whiteline is found
-Point DrawingLines(Mat img , Point point,bool right)
-{
-           int cols = img.cols;
-           Vec3b drawingLine = img.at<Vec3b>(point); //defines the color at current positions
-           while(point.x != cols){
-            if(right == true)
-            {
-            point.x = point.x +1; //increases the line too the right
-            drawingLine = img.at<cv::Vec3b>(point); 
-            if(FindWhiteLine(drawingLine)){ // quites incase white line is found
-                break; 
-            }
-        }
-        else if(right == false)
-            {
-            point.x = point.x -1; //Decrease the line too the left
-            drawingLine = img.at<cv::Vec3b>(point); 
-            if(FindWhiteLine(drawingLine)){ // quites incase white line is found
-                break; 
+    // Copies the complete frame out of the shared memory and mirrors it, like the original readSharedImage did.
+    bool copyFullFrame(core::wrapper::SharedMemory &memory, const SharedImage &si, Mat &frame) {
+        if (!memory.isValid()) {
+            return false;
+        }
+        frame.create(si.getHeight(), si.getWidth(), CV_8UC3);
+        memory.lock();
+        memcpy(frame.data, memory.getSharedMemory(), frame.total() * frame.elemSize());
+        memory.unlock();
+        flip(frame, frame, -1);
+        return true;
+    }
+
+    // Port of the algorithm in lanefollowing-old.cpp, so that a replay can run it next to the current one.
+    namespace legacy {
+        struct LegacyState {
+            bool intersection; // Set by the vertical probe and never cleared, as in the original.
+            SteeringData sd;
+            SpeedData spd;
+        };
+
+        // Walks along a row of the edge map until an edge is found; bounded at both row ends.
+        Point walkRow(const Mat &edges, Point point, bool right) {
+            while (true) {
+                point.x += (right ? 1 : -1);
+                if (point.x < 0 || point.x >= edges.cols || edges.at<uchar>(point) != 0) {
+                    return point;
+                }
             }
         }
+
+        // DrawingVertical: walks up from point to 150 rows above the bottom and flags any edge as intersection.
+        void probeIntersection(const Mat &edges, Point point, LegacyState &state) {
+            while (point.y > max(edges.rows - 150, 0)) {
+                point.y--;
+                if (edges.at<uchar>(point) != 0) {
+                    state.intersection = true;
+                }
+            }
+        }
+
+        // frame is the complete, mirrored BGR camera frame.
+        void followLane(const Mat &frame, LegacyState &state) {
+            Mat gray;
+            Mat edges;
+            cvtColor(frame, gray, CV_BGR2GRAY);
+            Canny(gray, edges, 50, 170, 3);
+
+            const int cols = edges.cols;
+            const int rows = edges.rows;
+
+            state.spd.setSpeedData(state.intersection ? 0 : 2);
+            probeIntersection(edges, Point(cols/2, rows-50), state);
+
+            Point rightEnd[4];
+            Point leftEnd[4];
+            for (int i = 0; i < 4; i++) {
+                const Point start(cols/2, 275 + i*25);
+                rightEnd[i] = walkRow(edges, start, true);
+                leftEnd[i] = walkRow(edges, start, false);
+            }
+
+            if ((rightEnd[2].x < 480 && rightEnd[0].x > 320)) {
+                double steeringAngle = -1 * (rightEnd[2].x % 26);
+                state.sd.setExampleData(steeringAngle+2); // +2 keeps the car straight
+            }
+            else if (leftEnd[0].x > 160) {
+                double steeringAngle = rightEnd[0].x / 24.615384615;// 640/26 = 24.615384615;
+                state.sd.setExampleData(steeringAngle);
+            }
+        }
+    } // legacy
+
+    // Outputs of both algorithms for one replayed frame.
+    struct ReplayOutput {
+        uint32_t frame;
+        double steering;
+        double speed;
+        bool intersection;
+        bool hasLegacy;
+        double legacySteering;
+        double legacySpeed;
+        bool hasReference;     // The frame was processed a second time with the reference edge detector.
+        double referenceSteering;
+        double referenceSpeed;
+        bool referenceIntersection;
+    };
+
+    // Prints how often and how much the configured edge detector steers differently from the reference
+    // detector and how long either took per frame.
+    void reportEdgeComparison(const vector<ReplayOutput> &outputs, const LatencyHistogram &frameLatency, const LatencyHistogram &referenceLatency,
+                              EdgeDetector configured, EdgeDetector reference) {
+        uint32_t compared = 0;
+        uint32_t differing = 0;
+        uint32_t intersectionDisagreements = 0;
+        double sumOfDifferences = 0;
+        double maximumDifference = 0;
+        for (uint32_t i = 0; i < outputs.size(); i++) {
+            if (outputs[i].hasReference) {
+                compared++;
+                const double difference = fabs(outputs[i].steering - outputs[i].referenceSteering);
+                sumOfDifferences += difference;
+                maximumDifference = max(maximumDifference, difference);
+                if ( (difference > 1e-6) || (fabs(outputs[i].speed - outputs[i].referenceSpeed) > 1e-6) ) {
+                    differing++;
+                }
+                if (outputs[i].intersection != outputs[i].referenceIntersection) {
+                    intersectionDisagreements++;
+                }
+            }
+        }
+        if (compared == 0) {
+            return;
+        }
+        cerr << "Edges " << getEdgeDetectorName(configured) << " vs " << getEdgeDetectorName(reference) << ": commands differ in "
+             << differing << " of " << compared << " frames, mean |steering difference| " << (sumOfDifferences / compared)
+             << ", maximum " << maximumDifference << ", intersections disagree in " << intersectionDisagreements << " frames." << endl;
+        cerr << "Edges " << getEdgeDetectorName(configured) << " frame p50=" << frameLatency.getPercentile(50) << "us p99="
+             << frameLatency.getPercentile(99) << "us, " << getEdgeDetectorName(reference) << " frame p50="
+             << referenceLatency.getPercentile(50) << "us p99=" << referenceLatency.getPercentile(99) << "us, mean speed-up "
+             << (frameLatency.getMean() > 0 ? referenceLatency.getMean() / frameLatency.getMean() : 0) << "x." << endl;
     }
-           return point;
-}
 
-    void LaneDetector::processImage() {
+    // Prints throughput, latency and disagreement of a replay and writes the output sequence as CSV to outputFile.
+    void reportReplay(const vector<ReplayOutput> &outputs, const LatencyHistogram &frameLatency, int64_t duration, const string &outputFile) {
+        uint32_t compared = 0;
+        uint32_t differing = 0;
+        for (uint32_t i = 0; i < outputs.size(); i++) {
+            if (outputs[i].hasLegacy) {
+                compared++;
+                if ( (fabs(outputs[i].steering - outputs[i].legacySteering) > 1e-6) ||
+                     (fabs(outputs[i].speed - outputs[i].legacySpeed) > 1e-6) ) {
+                    differing++;
+                }
+            }
+        }
 
-        //http://docs.opencv.org/doc/user_guide/ug_mat.html   Handeling images
-        Mat matImg(m_image);  //IPL is so deprecated it isnt even funny 
-        Mat gray; // for converting to gray
-
-        cvtColor(matImg, gray, CV_BGR2GRAY); //Let's make the image gray 
-        Mat canny; //Canny for detecting edges ,http://docs.opencv.org/doc/tutorials/imgproc/imgtrans/canny_detector/canny_detector.html
-        Canny(gray, canny, 50, 170, 3); //inputing Canny limits 
-        cvtColor(canny, matImg, CV_GRAY2BGR); //Converts back from gray
-
-        // get matrix size  http://docs.opencv.org/modules/core/doc/basic_structures.html
-        int cols = matImg.cols;
-        //int rows = matImg.rows;
-
-        Point myPointStart[4]; // array of startpoints
-        Point myPointRightEnd[4]; // array of rightEnd Point
-        Point myPointLeftEnd[4]; // array of LeftEnd Point
-        for(int i=1; i<4;i++)
-        {
-            myPointStart[0].x=cols/2;  // middle of the img
-            myPointStart[0].y=275; // start point of the Y axis , //275
-            myPointStart[i].x=myPointStart[0].x; //startpoint of each line
-            myPointStart[i].y=myPointStart[i-1].y+25; // Each point has a new Y-point  
-            //changes from 25 to 50, larger gap for reaching the intersection
-        }
-        for(int i=0; i<4;i++)
-        {
-            myPointRightEnd[i] = DrawingLines(matImg,myPointStart[i],true); // sends startpoint and extends it too the right
-            myPointLeftEnd[i] = DrawingLines(matImg,myPointStart[i],false); // sends startpoint and extends it too the Left
-        }
-
-       if (m_debug) {
-          //http://docs.opencv.org/doc/tutorials/core/basic_geometric_drawing/basic_geometric_drawing.html
-        for(int i=0; i<4;i++)
-        {
-            line(matImg, myPointStart[i],myPointRightEnd[i],cvScalar(0, 165, 255),1, 8); //Right line
-            line(matImg, myPointStart[i],myPointLeftEnd[i],cvScalar(52, 64, 76),1, 8); //Left line line
-         }
-            //line(matImg, center,centerEnd,cvScalar(0, 0, 255),1, 8); //centralline
-         imshow("Lanedetection", matImg);
-         cvWaitKey(10);
-}
-/*-----------Nicolas--------------*/
-/*-----------Emily--------------*/
-
-		//Right
-		//[3]494
-		//[2]471
-		//[1]448
-		//[0]425
-
-		//Left
-		//[3] 145
-		//[2] 168
-		//[1] 191
-		//[0] 214
-
-	double steeringAngle;
-	int desiredDistRight = 211; //desired dist to the side lane
-	//int desiredDistLeft = 180;//(145 + 168 + 191 + 214)/4
-	int difference;
-		
-//(actual distance - dotted line) - desiredright = difference that needs to be adjusted. when in staight road, this should be 0
-if (myPointRightEnd[0].x > 500) //is Rn lost?
-{
-	if (myPointLeftEnd[0].x < 214 || myPointLeftEnd[1].x < 191 || myPointLeftEnd[3].x < 145) // is left lost?
-	{
-		cout << "intersection" << endl;
-		sd.setExampleData(0);
-	 	spd.setSpeedData(2); // intersection
-	}
-		//else{
-		//	cout << "intersection" << endl; 
-		//	spd.setSpeedData(0);
-		//	sd.setExampleData(90);
-		//}
+        const double seconds = duration / 1e6;
+        cerr << "Replayed " << outputs.size() << " frames in " << seconds << " s ("
+             << (seconds > 0 ? outputs.size() / seconds : 0) << " frames/s)." << endl;
+        cerr << "Frame latency: p50=" << frameLatency.getPercentile(50) << "us p99=" << frameLatency.getPercentile(99)
+             << "us max=" << frameLatency.getMaximum() << "us" << endl;
+        if (compared > 0) {
+            cerr << "Current and legacy algorithm differ in " << differing << " of " << compared << " frames." << endl;
+        }
 
-}
-else // no, follow right
-{
-	difference = (myPointRightEnd[0].x - 214) - desiredDistRight; //use bottom line in case top lines disappear while turning or in intersection
-	steeringAngle = difference * 0.1;
-	sd.setExampleData(steeringAngle);
-	spd.setSpeedData(2);
-}
+        if (!outputFile.empty()) {
+            ofstream out(outputFile.c_str());
+            out << "frame,steering,speed,legacy_steering,legacy_speed,reference_steering,reference_speed" << "\n";
+            for (uint32_t i = 0; i < outputs.size(); i++) {
+                out << outputs[i].frame << "," << outputs[i].steering << "," << outputs[i].speed;
+                if (outputs[i].hasLegacy) {
+                    out << "," << outputs[i].legacySteering << "," << outputs[i].legacySpeed;
+                }
+                else {
+                    out << ",,";
+                }
+                if (outputs[i].hasReference) {
+                    out << "," << outputs[i].referenceSteering << "," << outputs[i].referenceSpeed;
+                }
+                else {
+                    out << ",,";
+                }
+                out << "\n";
+            }
+        }
+    }
+
+    struct Resolution {
+        int32_t width;
+        int32_t height;
+    };
+
+    // Parses a comma separated list of resolutions like "320x240,640x480".
+    vector<Resolution> parseResolutions(const string &list) {
+        vector<Resolution> resolutions;
+        stringstream sstr(list);
+        string item;
+        while (getline(sstr, item, ',')) {
+            stringstream value(item);
+            Resolution r;
+            char x = 0;
+            if ( (value >> r.width >> x >> r.height) && (x == 'x') && (r.width > 0) && (r.height > 0) ) {
+                resolutions.push_back(r);
+            }
+        }
+        return resolutions;
+    }
+
+    // Scales the rows and columns of a configuration tuned for 640x480 to width x height.
+    LaneFeatureExtractorConfiguration scaleConfiguration(const LaneFeatureExtractorConfiguration &configuration, int32_t width, int32_t height) {
+        const double sx = width / 640.0;
+        const double sy = height / 480.0;
+        LaneFeatureExtractorConfiguration c = configuration;
+        ScanlineGeometry &g = c.scanlines;
+        g.firstRow = cvRound(g.firstRow * sy);
+        g.spacing = cvRound(g.spacing * sy);
+        if (g.startColumn >= 0) {
+            g.startColumn = cvRound(g.startColumn * sx);
+        }
+        for (uint32_t i = 0; i < g.leftThresholds.size(); i++) {
+            if (g.leftThresholds[i] >= 0) {
+                g.leftThresholds[i] = cvRound(g.leftThresholds[i] * sx);
+            }
+        }
+        g.rightLostColumn = cvRound(g.rightLostColumn * sx);
+        g.laneOffset = cvRound(g.laneOffset * sx);
+        g.desiredDistRight = cvRound(g.desiredDistRight * sx);
+        c.tracking.window = max(1, cvRound(c.tracking.window * sx));
+        c.roiTop = cvRound(c.roiTop * sy);
+        c.roiBottom = cvRound(c.roiBottom * sy);
+        c.markingThreshold.minWidth = max(1, cvRound(c.markingThreshold.minWidth * sx));
+        c.intersection.halfWidth = cvRound(c.intersection.halfWidth * sx);
+        return c;
+    }
+
+    // Prints throughput and latency of feeding one synthetic scene at one resolution.
+    void reportSynthetic(const SceneParameters &scene, const LatencyHistogram &frameLatency, int64_t duration, double fps,
+                         uint32_t missedDeadlines, uint32_t intersections, double confidence) {
+        const double seconds = duration / 1e6;
+        const uint64_t frames = frameLatency.getCount();
+        cerr << "Synthetic " << getSceneKindName(scene.kind) << " " << scene.width << "x" << scene.height << ": "
+             << frames << " frames in " << seconds << " s (" << (seconds > 0 ? frames / seconds : 0) << " frames/s, ceiling "
+             << (frameLatency.getMean() > 0 ? 1e6 / frameLatency.getMean() : 0) << " frames/s)." << endl;
+        cerr << "Frame latency: p50=" << frameLatency.getPercentile(50) << "us p99=" << frameLatency.getPercentile(99)
+             << "us max=" << frameLatency.getMaximum() << "us" << endl;
+        if (fps > 0) {
+            cerr << "Missed " << missedDeadlines << " of " << frames << " deadlines at " << fps << " frames/s." << endl;
+        }
+        cerr << "Intersection in " << intersections << " frames, mean confidence " << (frames > 0 ? confidence / frames : 0) << "." << endl;
+    }
 
+    // Name of the OpenCV window showing the scanlines with lanedetector.debug=1.
+    const char *DEBUG_WINDOW = "Lanedetection";
 
+    // What the visualisation needs to draw one frame.
+    struct DebugSnapshot {
+        FrameView view;     // view.pixels is the copied edge band.
+        vector<Point> start;
+        vector<Point> leftEnd;
+        vector<Point> rightEnd;
+    };
+
+    // Exchanges two snapshots without copying any pixels or points.
+    void swapSnapshots(DebugSnapshot &a, DebugSnapshot &b) {
+        std::swap(a.view, b.view);
+        a.start.swap(b.start);
+        a.leftEnd.swap(b.leftEnd);
+        a.rightEnd.swap(b.rightEnd);
+    }
+
+    // Draws snapshots of the lane scan in its own thread and at its own rate, so that debugging
+    // never slows down processImage. Holds at most one pending snapshot: a newer one replaces it.
+    class DebugVisualisation : public Service {
+        public:
+            DebugVisualisation(double framesPerSecond) :
+                m_mutex(),
+                m_incoming(),
+                m_pending(),
+                m_rendering(),
+                m_image(),
+                m_hasPending(false),
+                m_period(static_cast<int64_t>(1000000 / max(framesPerSecond, 1.0))),
+                m_dropped(0) {}
+
+            virtual void beforeStop() {}
+
+            // Called by the processing thread only; copies the edge band and the scanline ends.
+            void publish(const FrameView &edgeView, const vector<Point> &start, const vector<Point> &leftEnd, const vector<Point> &rightEnd) {
+                edgeView.pixels.copyTo(m_incoming.view.pixels);
+                m_incoming.view.firstRow = edgeView.firstRow;
+                m_incoming.view.mirrored = edgeView.mirrored;
+                m_incoming.view.scale = edgeView.scale;
+                m_incoming.start.assign(start.begin(), start.end());
+                m_incoming.leftEnd.assign(leftEnd.begin(), leftEnd.end());
+                m_incoming.rightEnd.assign(rightEnd.begin(), rightEnd.end());
+
+                Lock l(m_mutex);
+                if (m_hasPending) {
+                    m_dropped++;
+                }
+                swapSnapshots(m_incoming, m_pending);
+                m_hasPending = true;
+            }
+
+            uint32_t getDropped() const {
+                return m_dropped;
+            }
+
+            virtual void run() {
+                serviceReady();
+                // HighGUI wants the window to be created, updated and destroyed by the same thread.
+                namedWindow(DEBUG_WINDOW, CV_WINDOW_AUTOSIZE);
+                moveWindow(DEBUG_WINDOW, 300, 100);
+
+                while (isRunning()) {
+                    const int64_t start = monotonicMicroseconds();
+                    bool hasSnapshot = false;
+                    {
+                        Lock l(m_mutex);
+                        if (m_hasPending) {
+                            swapSnapshots(m_pending, m_rendering);
+                            m_hasPending = false;
+                            hasSnapshot = true;
+                        }
+                    }
+                    if (hasSnapshot) {
+                        render(m_rendering);
+                    }
+                    waitKey(1); // Lets HighGUI handle its events.
+
+                    const int64_t remaining = m_period - (monotonicMicroseconds() - start);
+                    if (remaining > 0) {
+                        Thread::usleepFor(remaining);
+                    }
+                }
+
+                destroyWindow(DEBUG_WINDOW);
+            }
+
+        private:
+            void render(const DebugSnapshot &snapshot) {
+                //http://docs.opencv.org/doc/tutorials/core/basic_geometric_drawing/basic_geometric_drawing.html
+                cvtColor(snapshot.view.pixels, m_image, CV_GRAY2BGR); // colour is only needed for drawing
+                for (uint32_t i = 0; i < snapshot.start.size(); i++) {
+                    line(m_image, toViewPixels(snapshot.view, snapshot.start[i]), toViewPixels(snapshot.view, snapshot.rightEnd[i]), cvScalar(0, 165, 255), 1, 8); //Right line
+                    line(m_image, toViewPixels(snapshot.view, snapshot.start[i]), toViewPixels(snapshot.view, snapshot.leftEnd[i]), cvScalar(52, 64, 76), 1, 8); //Left line line
+                }
+                if (snapshot.view.mirrored) {
+                    flip(m_image, m_image, -1); // show it the right way up
+                }
+                imshow(DEBUG_WINDOW, m_image);
+            }
+
+            Mutex m_mutex;
+            DebugSnapshot m_incoming;  // Filled by publish, outside of the lock.
+            DebugSnapshot m_pending;   // Guarded by m_mutex.
+            DebugSnapshot m_rendering; // Only used by run.
+            Mat m_image;
+            bool m_hasPending;         // Guarded by m_mutex.
+            int64_t m_period;
+            uint32_t m_dropped;        // Guarded by m_mutex.
+    };
+
+    DebugVisualisation *visualisation = NULL;
+
+    // Stops the debug window thread, if body() started one.
+    void stopVisualisation() {
+        if (visualisation != NULL) {
+            visualisation->stop();
+            cerr << "Debug window skipped " << visualisation->getDropped() << " frames." << endl;
+            visualisation = NULL;
+        }
+    }
+
+    // Appends the scanline hits and the command of a frame to the frame log.
+    void logFrame(const LaneFeatures &features, const LaneFollowingCommand &command) {
+        FrameRecord record = emptyFrameRecord(FRAME_LOG_LANEDETECTOR);
+        record.frameSequence = command.getFrameSequence();
+        record.flags = command.getIntersection() ? FRAME_INTERSECTION : 0;
+        record.captured = features.captured;
+        record.logged = monotonicMicroseconds();
+        record.steering = command.getSteering();
+        record.speed = command.getSpeed();
+        record.confidence = command.getConfidence();
+        record.intersectionConfidence = command.getIntersectionConfidence();
+        record.numberOfScanlines = min(features.start.size(), static_cast<size_t>(FrameRecord::MAX_SCANLINES));
+        for (uint32_t i = 0; i < record.numberOfScanlines; i++) {
+            record.row[i] = features.start[i].y;
+            record.left[i] = features.leftEnd[i].x;
+            record.right[i] = features.rightEnd[i].x;
+        }
+        if (!frameLog.append(record)) {
+            logger.log(LOG_ERROR, "Frame log could not grow; frame % is missing.", record.frameSequence);
+        }
+    }
+
+    void LaneDetector::processImage() {
+        if (dropFrame()) {
+            releaseLockedFrame();
+            return;
+        }
+        LaneFeatures &features = laneFeatures;
+        extractor.detectEdges(frameView, features);
+        releaseLockedFrame(); // zero-copy frames are not needed any longer
+        extractor.findFeatures(features);
+        if (perspective.isCompiled() && (extractor.isPerspectiveBound() == perspectiveMismatch)) {
+            perspectiveMismatch = !perspectiveMismatch;
+            if (perspectiveMismatch) {
+                logger.log(LOG_WARNING, "The perspective calibration is for frames % pixels wide; scanning frame rows instead.",
+                           perspective.getCalibration().width);
+            }
+            else {
+                logger.log(LOG_INFO, "The perspective calibration fits the frames again; scanning the bird's-eye strip.");
+            }
+        }
+        if (features.grayMicroseconds >= 0) {
+            latency.record(STAGE_GRAY, features.grayMicroseconds);
+        }
+        latency.record(STAGE_CANNY, features.edgesMicroseconds);
+        latency.record(STAGE_SCAN, features.scanMicroseconds);
+
+        if ( (visualisation != NULL) && (scheduler.level < LOAD_NO_DEBUG) ) {
+            // Rendering happens in the visualisation thread; this only copies the edge band.
+            visualisation->publish(extractor.getEdges(), features.start, features.leftEnd, features.rightEnd);
+        }
 
         //TODO: Start here.
         // 1. Do something with the image m_image here, for example: find lane marking features, optimize quality, ...
@@ -248,12 +1067,42 @@ else // no, follow right
         // Here, you see an example of how to send the data structure SteeringData to the ContainerConference. This data structure will be received by all running components. In our example, it will be processed by Driver. To change this data structure, have a look at Data.odvd in the root folder of this source.
 
 
-        // Create container for finally sending the data.
-        Container c(Container::USER_DATA_1, sd);
-        Container c_1(Container::USER_DATA_2, spd);
+        LaneFollowingCommand &command = lastCommand.command;
+        command.setSteering(features.steering);
+        command.setSpeed(features.speed);
+        command.setIntersection(features.intersection);
+        command.setConfidence(features.confidence);
+        command.setIntersectionConfidence(features.intersectionConfidence);
+        command.setFrameSequence(frameSequence++);
+        command.setCaptureSeconds(static_cast<uint32_t>(features.captured / 1000000));
+        command.setCaptureMicroseconds(static_cast<uint32_t>(features.captured % 1000000));
+        lastCommand.acquired = features.acquired;
+        if (frameLog.isOpen()) {
+            logFrame(features, command);
+        }
+        if (features.intersection) {
+            logger.log(LOG_INFO, "Intersection in frame %, confidence %", command.getFrameSequence(), features.intersectionConfidence);
+        }
+        logger.log(LOG_DEBUG, "Frame %: steering % speed % confidence %", command.getFrameSequence(), features.steering, features.speed, features.confidence);
+        // Sending is not part of the budget; the publishing stage of the pipeline does it on its own thread.
+        updateLoadLevel(monotonicMicroseconds() - features.acquired);
+        if (headless) {
+            return;
+        }
+        if (pipeline.enabled) {
+            // Sending is left to the publishing stage.
+            pipeline.commands.push(lastCommand);
+            return;
+        }
+
+        const int64_t stageStart = monotonicMicroseconds();
+        // Create container for finally sending the data; steering and speed travel together in one LaneFollowingCommand.
+        Container c(Container::USER_DATA_3, command);
         // Send container.
         getConference().send(c);
-        getConference().send(c_1);
+        const int64_t stageEnd = monotonicMicroseconds();
+        latency.record(STAGE_SEND, stageEnd - stageStart);
+        latency.record(STAGE_FRAME, stageEnd - features.acquired);
 
     
 }
@@ -264,48 +1113,348 @@ else // no, follow right
         // Get configuration data.
         KeyValueConfiguration kv = getKeyValueConfiguration();
         m_debug = kv.getValue<int32_t> ("lanedetector.debug") == 1;
+        acquisitionMode = static_cast<AcquisitionMode>(getOptionalValue<int32_t>(kv, "lanedetector.acquisition", ACQUIRE_FULL_FRAME));
+        LaneFeatureExtractorConfiguration configuration = extractorConfiguration;
+        // Zero-copy frames are given back before the scan, so there is nothing to refine with.
+        configuration.refineHits = configuration.refineHits && (acquisitionMode != ACQUIRE_ZERO_COPY);
+        extractor.configure(configuration);
+        extractor.setPerspective(&perspective);
+        roiTop = configuration.roiTop;
+        roiBottom = configuration.roiBottom;
+        bandMargin = extractor.getEdgeMargin();
+
+        const int32_t benchmarkIterations = getOptionalValue<int32_t>(kv, "lanedetector.benchmark.edgesearch", 0);
+        if (benchmarkIterations > 0) {
+            benchmarkEdgeSearch(benchmarkIterations);
+        }
+        const int32_t edgeBenchmarkIterations = getOptionalValue<int32_t>(kv, "lanedetector.benchmark.edges", 0);
+        if (edgeBenchmarkIterations > 0) {
+            benchmarkEdgeDetectors(configuration, edgeBenchmarkIterations);
+        }
 
-        Player *player = NULL;
-/*
         // Lane-detector can also directly read the data from file. This might be interesting to inspect the algorithm step-wisely.
-        core::io::URL url("file://recorder.rec");
-        // Size of the memory buffer.
-        const uint32_t MEMORY_SEGMENT_SIZE = kv.getValue<uint32_t>("global.buffer.memorySegmentSize");
-        // Number of memory segments.
-        const uint32_t NUMBER_OF_SEGMENTS = kv.getValue<uint32_t>("global.buffer.numberOfMemorySegments");
-        // If AUTO_REWIND is true, the file will be played endlessly.
-        const bool AUTO_REWIND = true;
-        player = new Player(url, AUTO_REWIND, MEMORY_SEGMENT_SIZE, NUMBER_OF_SEGMENTS);
-*/
+        // Set lanedetector.replay to for example file://recorder.rec to process a recording once, as fast as possible.
+        const string replayURL = getOptionalValue<string>(kv, "lanedetector.replay", "");
+
+        idleSleep = getOptionalValue<uint32_t>(kv, "lanedetector.idleSleep", idleSleep);
+        // Microseconds a frame may take from acquisition to its command before optional work is shed; 0 never sheds.
+        scheduler.budget = getOptionalValue<int64_t>(kv, "lanedetector.deadline.budget", 0);
+        scheduler.recoverShare = getOptionalValue<double>(kv, "lanedetector.deadline.recoverShare", scheduler.recoverShare);
+        scheduler.recoverFrames = getOptionalValue<uint32_t>(kv, "lanedetector.deadline.recoverFrames", scheduler.recoverFrames);
+
+        // Start the debug window first so that it shows replays and the pipelined mode, too.
+        DebugVisualisation debugVisualisation(getOptionalValue<double>(kv, "lanedetector.debug.fps", 15));
+        if (m_debug) {
+            visualisation = &debugVisualisation;
+            debugVisualisation.start();
+        }
+        latencyFile = getOptionalValue<string>(kv, "lanedetector.latency.csv", "");
+
+        if (!replayURL.empty()) {
+            core::io::URL url(replayURL);
+            // Size of the memory buffer.
+            const uint32_t MEMORY_SEGMENT_SIZE = kv.getValue<uint32_t>("global.buffer.memorySegmentSize");
+            // Number of memory segments.
+            const uint32_t NUMBER_OF_SEGMENTS = kv.getValue<uint32_t>("global.buffer.numberOfMemorySegments");
+            // If AUTO_REWIND is true, the file will be played endlessly; a benchmark needs every frame exactly once.
+            const bool AUTO_REWIND = false;
+            Player *player = new Player(url, AUTO_REWIND, MEMORY_SEGMENT_SIZE, NUMBER_OF_SEGMENTS);
+
+            // Headless benchmark: nothing is sent, every frame is processed and timed.
+            const bool compareLegacy = getOptionalValue<int32_t>(kv, "lanedetector.replay.compareLegacy", 0) == 1;
+            const string outputFile = getOptionalValue<string>(kv, "lanedetector.replay.output", "");
+            // Processes every frame a second time with this detector to compare accuracy and speed.
+            const string compareEdges = getOptionalValue<string>(kv, "lanedetector.replay.compareEdges", "");
+            // The reference follows the lane markings with its own tracks and its own last command.
+            LaneFeatureExtractorConfiguration referenceConfiguration = configuration;
+            if (!compareEdges.empty()) {
+                referenceConfiguration.edgeDetector = readEdgeDetector(compareEdges);
+            }
+            LaneFeatureExtractor referenceExtractor(referenceConfiguration);
+            referenceExtractor.setPerspective(&perspective);
+            LaneFeatures referenceFeatures;
+            headless = true;
+
+            vector<ReplayOutput> outputs;
+            LatencyHistogram frameLatency;
+            LatencyHistogram referenceLatency;
+            legacy::LegacyState legacyState;
+            legacyState.intersection = false;
+            Mat fullFrame;
+
+            const int64_t replayStart = monotonicMicroseconds();
+            while ( (getModuleState() == ModuleState::RUNNING) && player->hasMoreData() ) {
+                Container c = player->getNextContainerToBeSent();
+                if (c.getDataType() != Container::SHARED_IMAGE) {
+                    continue;
+                }
+
+                const int64_t frameStart = monotonicMicroseconds();
+                if (!readSharedImage(c)) {
+                    continue;
+                }
+                processImage();
+                releaseLockedFrame();
+                frameLatency.add(monotonicMicroseconds() - frameStart);
+
+                ReplayOutput output;
+                output.frame = outputs.size();
+                output.steering = lastCommand.command.getSteering();
+                output.speed = lastCommand.command.getSpeed();
+                output.intersection = lastCommand.command.getIntersection();
+                output.hasReference = false;
+                if (!compareEdges.empty()) {
+                    // Read the frame again with the margin the reference detector needs.
+                    const int64_t referenceStart = monotonicMicroseconds();
+                    bandMargin = referenceExtractor.getEdgeMargin();
+                    if (readSharedImage(c)) {
+                        referenceExtractor.extract(frameView, referenceFeatures);
+                        releaseLockedFrame();
+                        referenceLatency.add(monotonicMicroseconds() - referenceStart);
+                        output.hasReference = true;
+                        output.referenceSteering = referenceFeatures.steering;
+                        output.referenceSpeed = referenceFeatures.speed;
+                        output.referenceIntersection = referenceFeatures.intersection;
+                    }
+                    bandMargin = extractor.getEdgeMargin();
+                }
+                output.hasLegacy = compareLegacy && copyFullFrame(*m_sharedImageMemory, c.getData<SharedImage>(), fullFrame);
+                if (output.hasLegacy) {
+                    legacy::followLane(fullFrame, legacyState);
+                    output.legacySteering = legacyState.sd.getExampleData();
+                    output.legacySpeed = legacyState.spd.getSpeedData();
+                }
+                outputs.push_back(output);
+            }
+            reportReplay(outputs, frameLatency, monotonicMicroseconds() - replayStart, outputFile);
+            reportEdgeComparison(outputs, frameLatency, referenceLatency, configuration.edgeDetector, referenceConfiguration.edgeDetector);
+
+            OPENDAVINCI_CORE_DELETE_POINTER(player);
+            stopVisualisation();
+            return ModuleState::OKAY;
+        }
+
+        // Set lanedetector.fleet to comma separated recordings, or lanedetector.fleet.list to a file naming one per line, to
+        // replay all of them on all cores, each by a detector of its own, and compare them with the commands recorded in them.
+        vector<string> fleet;
+        stringstream fleetURLs(getOptionalValue<string>(kv, "lanedetector.fleet", ""));
+        string fleetURL;
+        while (getline(fleetURLs, fleetURL, ',')) {
+            if (!fleetURL.empty()) {
+                fleet.push_back(fleetURL);
+            }
+        }
+        const string fleetList = getOptionalValue<string>(kv, "lanedetector.fleet.list", "");
+        if (!fleetList.empty()) {
+            ifstream in(fleetList.c_str());
+            if (!in.good()) {
+                cerr << "Could not read the recordings listed in " << fleetList << endl;
+            }
+            while (getline(in, fleetURL)) {
+                if (!fleetURL.empty() && (fleetURL[0] != '#')) {
+                    fleet.push_back(fleetURL);
+                }
+            }
+        }
+        if (!fleet.empty()) {
+            FleetConfiguration fleetConfiguration;
+            fleetConfiguration.workers = getOptionalValue<uint32_t>(kv, "lanedetector.fleet.workers", fleetConfiguration.workers);
+            fleetConfiguration.tolerance = getOptionalValue<double>(kv, "lanedetector.fleet.tolerance", fleetConfiguration.tolerance);
+            fleetConfiguration.memorySegmentSize = getOptionalValue<uint32_t>(kv, "global.buffer.memorySegmentSize", fleetConfiguration.memorySegmentSize);
+            fleetConfiguration.numberOfSegments = getOptionalValue<uint32_t>(kv, "global.buffer.numberOfMemorySegments", fleetConfiguration.numberOfSegments);
+
+            FleetEvaluation evaluation(configuration, &perspective, fleetConfiguration);
+            evaluation.start(fleet);
+            while (!evaluation.isFinished() && (getModuleState() == ModuleState::RUNNING)) {
+                Thread::usleepFor(10000);
+            }
+            const vector<RecordingReport> reports = evaluation.stop();
+            cerr << describeFleet(reports, evaluation.getDuration(), evaluation.getNumberOfWorkers());
+            const string fleetOutput = getOptionalValue<string>(kv, "lanedetector.fleet.output", "");
+            if (!fleetOutput.empty() && !writeFleetCSV(reports, fleetOutput)) {
+                cerr << "Could not write the fleet report to " << fleetOutput << endl;
+            }
+            stopVisualisation();
+            return ModuleState::OKAY;
+        }
+
+        // Set lanedetector.synthetic to a scene (straight, curved, dashed, noright or intersection) to feed rendered
+        // frames through the shared memory at every resolution in lanedetector.synthetic.resolutions. With lanedetector.ipm.enabled=1
+        // the resolutions the calibration is not for check the fall back to frame rows, tracks included.
+        const string syntheticScene = getOptionalValue<string>(kv, "lanedetector.synthetic", "");
+        if (!syntheticScene.empty()) {
+            SceneParameters scene;
+            if (!parseSceneKind(syntheticScene, scene.kind)) {
+                cerr << "Unknown synthetic scene " << syntheticScene << "; using straight." << endl;
+            }
+            scene.curvature = getOptionalValue<double>(kv, "lanedetector.synthetic.curvature", scene.curvature);
+            scene.noise = getOptionalValue<double>(kv, "lanedetector.synthetic.noise", scene.noise);
+            scene.glare = getOptionalValue<double>(kv, "lanedetector.synthetic.glare", scene.glare);
+            scene.seed = getOptionalValue<uint32_t>(kv, "lanedetector.synthetic.seed", scene.seed);
+            const vector<Resolution> resolutions = parseResolutions(getOptionalValue<string>(kv, "lanedetector.synthetic.resolutions", "320x240,640x480,1280x720,1920x1080"));
+            const uint32_t frames = getOptionalValue<uint32_t>(kv, "lanedetector.synthetic.frames", 500);
+            // Frames per second offered to the detector; 0 feeds the next frame as soon as the last one is done.
+            const double fps = getOptionalValue<double>(kv, "lanedetector.synthetic.fps", 0);
+            const int64_t period = (fps > 0) ? static_cast<int64_t>(1e6 / fps) : 0;
+            // Frames are rendered ahead so that drawing them is not timed; the dashes repeat after this many.
+            const uint32_t numberOfRenderedFrames = max(1u, min(frames, 32u));
+
+            // One segment for the largest resolution; readSharedImage attaches to it by name like to the camera's.
+            const string memoryName = "lanedetector.synthetic";
+            uint32_t largest = 0;
+            for (uint32_t i = 0; i < resolutions.size(); i++) {
+                largest = max(largest, static_cast<uint32_t>(resolutions[i].width * resolutions[i].height * 3));
+            }
+            core::SharedPointer<core::wrapper::SharedMemory> memory = core::wrapper::SharedMemoryFactory::createSharedMemory(memoryName, largest);
+            if (!memory->isValid()) {
+                cerr << "Could not create shared memory for the synthetic frames." << endl;
+                stopVisualisation();
+                return ModuleState::OKAY;
+            }
+            headless = true;
+
+            for (uint32_t r = 0; (r < resolutions.size()) && (getModuleState() == ModuleState::RUNNING); r++) {
+                scene.width = resolutions[r].width;
+                scene.height = resolutions[r].height;
+                const uint32_t bytes = scene.width * scene.height * 3;
+                SyntheticLaneScene renderer(scene);
+                vector<vector<char> > rendered(numberOfRenderedFrames, vector<char>(bytes));
+                for (uint32_t i = 0; i < numberOfRenderedFrames; i++) {
+                    renderer.renderSharedImage(i, &rendered[i][0]);
+                }
+
+                // Scanlines and thresholds are tuned for 640x480; move them to where the scene puts the lines.
+                const LaneFeatureExtractorConfiguration scaled = scaleConfiguration(configuration, scene.width, scene.height);
+                extractor.configure(scaled);
+                roiTop = scaled.roiTop;
+                roiBottom = scaled.roiBottom;
+                bandMargin = extractor.getEdgeMargin();
+
+                SharedImage si;
+                si.setName(memoryName);
+                si.setWidth(scene.width);
+                si.setHeight(scene.height);
+                si.setBytesPerPixel(3);
+                si.setSize(bytes);
+
+                LatencyHistogram frameLatency;
+                uint32_t missedDeadlines = 0;
+                uint32_t intersections = 0;
+                double confidence = 0;
+                const int64_t runStart = monotonicMicroseconds();
+                int64_t nextFrame = runStart;
+                for (uint32_t i = 0; (i < frames) && (getModuleState() == ModuleState::RUNNING); i++) {
+                    if (period > 0) {
+                        const int64_t now = monotonicMicroseconds();
+                        if (nextFrame > now) {
+                            Thread::usleepFor(nextFrame - now);
+                        }
+                        // A late detector gets the newest frame, not a backlog of old ones.
+                        nextFrame = max(nextFrame, now) + period;
+                    }
+                    // The camera's part: publish the next frame.
+                    memory->lock();
+                    memcpy(memory->getSharedMemory(), &rendered[i % numberOfRenderedFrames][0], bytes);
+                    memory->unlock();
+                    Container c(Container::SHARED_IMAGE, si);
+
+                    const int64_t frameStart = monotonicMicroseconds();
+                    if (!readSharedImage(c)) {
+                        continue;
+                    }
+                    processImage();
+                    releaseLockedFrame();
+                    const int64_t frameLatencyMicroseconds = monotonicMicroseconds() - frameStart;
+                    frameLatency.add(frameLatencyMicroseconds);
+                    if ( (period > 0) && (frameLatencyMicroseconds > period) ) {
+                        missedDeadlines++;
+                    }
+                    intersections += lastCommand.command.getIntersection() ? 1 : 0;
+                    confidence += lastCommand.command.getConfidence();
+                }
+                reportSynthetic(scene, frameLatency, monotonicMicroseconds() - runStart, fps, missedDeadlines, intersections, confidence);
+            }
+
+            stopVisualisation();
+            return ModuleState::OKAY;
+        }
+
+        pipeline.enabled = (getOptionalValue<int32_t>(kv, "lanedetector.pipeline", 0) == 1);
+        if (pipeline.enabled) {
+            // Acquisition and publishing get their own threads; this thread only processes.
+            for (uint32_t i = 0; i < NUMBER_OF_FRAME_SLOTS; i++) {
+                pipeline.freeSlots.push(i);
+            }
+            FrameAcquisition acquisition(getKeyValueDataStore());
+            CommandPublisher publisher(getConference());
+            acquisition.start();
+            publisher.start();
+
+            while (getModuleState() == ModuleState::RUNNING) {
+                uint32_t slot = 0;
+                if (pipeline.readySlots.pop(slot)) {
+                    // Latest frame wins: older waiting frames go straight back to acquisition.
+                    uint32_t newer = 0;
+                    while (pipeline.readySlots.pop(newer)) {
+                        pipeline.freeSlots.push(slot);
+                        pipeline.droppedFrames++;
+                        slot = newer;
+                    }
+                    frameView = pipeline.slots[slot].view;
+                    processImage();
+                    pipeline.freeSlots.push(slot);
+                }
+                else {
+                    Thread::usleepFor(500);
+                }
+            }
+
+            acquisition.stop();
+            publisher.stop();
+            cerr << "Pipeline skipped " << pipeline.duplicateFrames << " duplicate frames, " << pipeline.droppedFrames << " late frames and " << pipeline.droppedCommands << " commands." << endl;
+            stopVisualisation();
+            return ModuleState::OKAY;
+        }
+
+        int64_t lastFrame = -1;
+        uint32_t duplicateFrames = 0;
 
         // "Working horse."
         while (getModuleState() == ModuleState::RUNNING) {
             bool has_next_frame = false;
 
-            // Use the shared memory image.
-            Container c;
-            if (player != NULL) {
-                // Read the next container from file.
-                c = player->getNextContainerToBeSent();
-            }
-            else {
-                // Get the most recent available container for a SHARED_IMAGE.
-                c = getKeyValueDataStore().get(Container::SHARED_IMAGE);
+            // Get the most recent available container for a SHARED_IMAGE.
+            Container c = getKeyValueDataStore().get(Container::SHARED_IMAGE);
+
+            // The data store keeps returning the last frame until the camera delivers a new one.
+            if ( (c.getDataType() == Container::SHARED_IMAGE) && (frameIdentity(c) == lastFrame) ) {
+                duplicateFrames++;
+                Thread::usleepFor(idleSleep);
+                continue;
             }
 
             if (c.getDataType() == Container::SHARED_IMAGE) {
                 // Example for processing the received container.
                 has_next_frame = readSharedImage(c);
+                if (true == has_next_frame) {
+                    lastFrame = frameIdentity(c);
+                }
             }
 
             // Process the read image.
             if (true == has_next_frame) {
                 processImage();
             }
+            else {
+                // No camera frame yet, or its shared memory cannot be attached yet: do not retry at full speed.
+                Thread::usleepFor(idleSleep);
+            }
+            releaseLockedFrame();
         }
 
-        OPENDAVINCI_CORE_DELETE_POINTER(player);
+        cerr << "Skipped " << duplicateFrames << " duplicate frames." << endl;
 
+        stopVisualisation();
         return ModuleState::OKAY;
     }
 } // msv